@@ -0,0 +1,192 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cilk/cilk_api.h>
+
+#include "../runtime/cilk2c.h"
+#include "../runtime/cilk2c_inlined.c"
+
+/*
+ * cilk_malloc across the lifetime of the runtime.  A static constructor that
+ * runs before the runtime starts allocates blocks, which come from malloc,
+ * and Cilk code and code outside Cilk code free them once the runtime is up.
+ * While Cilk code runs, a thread that is not a worker allocates and frees
+ * blocks, some of which Cilk code allocated or frees.  Cilk code allocates
+ * blocks from the pool that a static destructor frees after the runtime has
+ * shut down.  Freed blocks of malloc must go back to malloc rather than into
+ * the pool, so the next allocation of the same size must not return them.
+ *
+__attribute__((constructor(101))) void early(void) {
+    early_small[0] = cilk_malloc(SMALL);
+    early_small[1] = cilk_malloc(SMALL);
+    early_large = cilk_malloc(LARGE);
+}
+
+void in_cilk(void) {
+    cilk_spawn dummy(NULL);
+    cilk_free(early_small[0], SMALL);
+    void *p = cilk_malloc(SMALL);
+    check(p != early_small[0]);
+    cilk_free(p, SMALL);
+    cilk_free(early_large, LARGE);
+    from_cilk = cilk_malloc(SMALL);
+    pthread_create(&t, NULL, outside, NULL);
+    pthread_join(t, NULL);
+    p = cilk_malloc(SMALL);
+    check(p != from_cilk);
+    cilk_free(p, SMALL);
+    cilk_free(from_thread, SMALL);
+    late_small = cilk_malloc(SMALL);
+    late_large = cilk_malloc(LARGE);
+}
+
+void *outside(void *arg) {
+    for (int i = 0; i < ROUNDS; i++)
+        cilk_free(cilk_malloc(SMALL), SMALL);
+    from_thread = cilk_malloc(SMALL);
+    cilk_free(from_cilk, SMALL);
+    return NULL;
+}
+
+int main(void) {
+    in_cilk();
+    cilk_free(early_small[1], SMALL);
+    void *p = cilk_malloc(SMALL);
+    check(p != early_small[1]);
+    cilk_free(p, SMALL);
+}
+
+__attribute__((destructor(101))) void late(void) {
+    cilk_free(late_small, SMALL);
+    cilk_free(late_large, LARGE);
+    void *p = cilk_malloc(SMALL);
+    cilk_free(p, SMALL);
+}
+*/
+
+/* A small size, and a page-aligned size larger than any bucket. */
+#define SMALL 48
+#define LARGE (4 * 4096)
+#define ROUNDS 10000
+
+extern size_t ZERO;
+void __attribute__((weak)) dummy(void *p) { return; }
+
+static void *early_small[2], *early_large;
+static void *late_small, *late_large;
+static void *from_cilk, *from_thread;
+static int failed;
+
+static void check(int ok, const char *what) {
+    if (!ok) {
+        fprintf(stderr, "alloc_lifetime test FAILED: %s.\n", what);
+        failed = 1;
+    }
+}
+
+/* Runs before the runtime starts, whose constructor has default priority. */
+__attribute__((constructor(101))) static void early(void) {
+    for (int i = 0; i < 2; i++) {
+        early_small[i] = cilk_malloc(SMALL);
+        memset(early_small[i], 0x5a, SMALL);
+    }
+    early_large = cilk_malloc(LARGE);
+    memset(early_large, 0x5a, LARGE);
+}
+
+/* Runs on a thread that is not a worker while a region runs. */
+static void *outside(void *arg) {
+    void *blocks[64];
+    for (int i = 0; i < ROUNDS; i++) {
+        void **p = &blocks[i % 64];
+        if (i >= 64)
+            cilk_free(*p, SMALL);
+        *p = cilk_malloc(SMALL);
+        memset(*p, 0x5a, SMALL);
+    }
+    for (int i = 0; i < 64; i++)
+        cilk_free(blocks[i], SMALL);
+    from_thread = cilk_malloc(SMALL);
+    memset(from_thread, 0x5a, SMALL);
+    cilk_free(from_cilk, SMALL);
+    return arg;
+}
+
+static void __attribute__((noinline))
+in_cilk_spawn_helper(__cilkrts_stack_frame *parent);
+
+static void in_cilk(void) {
+    dummy(alloca(ZERO));
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame(&sf);
+
+    /* cilk_spawn dummy(NULL) */
+    if (!__cilk_prepare_spawn(&sf)) {
+        in_cilk_spawn_helper(&sf);
+    }
+
+    cilk_free(early_small[0], SMALL);
+    void *p = cilk_malloc(SMALL);
+    check(p != early_small[0], "a worker reused a block of malloc");
+    cilk_free(p, SMALL);
+    cilk_free(early_large, LARGE);
+
+    from_cilk = cilk_malloc(SMALL);
+    memset(from_cilk, 0x5a, SMALL);
+    pthread_t t;
+    check(pthread_create(&t, NULL, outside, NULL) == 0,
+          "cannot create a thread");
+    pthread_join(t, NULL);
+    p = cilk_malloc(SMALL);
+    check(p != from_cilk, "a thread outside Cilk code used a worker's blocks");
+    cilk_free(p, SMALL);
+    cilk_free(from_thread, SMALL);
+
+    late_small = cilk_malloc(SMALL);
+    memset(late_small, 0x5a, SMALL);
+    late_large = cilk_malloc(LARGE);
+    memset(late_large, 0x5a, LARGE);
+
+    /* cilk_sync */
+    __cilk_sync_nothrow(&sf);
+
+    __cilk_parent_epilogue(&sf);
+}
+
+static void __attribute__((noinline))
+in_cilk_spawn_helper(__cilkrts_stack_frame *parent) {
+
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame_helper(&sf, parent, false);
+    __cilkrts_detach(&sf, parent);
+    dummy(NULL);
+    __cilk_helper_epilogue(&sf, parent, false);
+}
+
+/* Runs after the runtime has shut down. */
+__attribute__((destructor(101))) static void late(void) {
+    cilk_free(late_small, SMALL);
+    cilk_free(late_large, LARGE);
+    void *p = cilk_malloc(SMALL);
+    memset(p, 0x5a, SMALL);
+    cilk_free(p, SMALL);
+    if (failed)
+        _exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    in_cilk();
+
+    cilk_free(early_small[1], SMALL);
+    void *p = cilk_malloc(SMALL);
+    check(p != early_small[1], "the depot reused a block of malloc");
+    cilk_free(p, SMALL);
+
+    if (failed)
+        return 1;
+    printf("Result: ok\n");
+    return 0;
+}
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../runtime/cilk2c.h"
+#include "../runtime/cilk2c_inlined.c"
+#include "getoptions.h"
+#include "ktiming.h"
+
+#ifndef TIMING_COUNT
+#define TIMING_COUNT 1
+#endif
+
+/*
+ * Fiber churn microbenchmark.  Every steal needs a fresh fiber and every
+ * sync that suspends gives one back, so a wide, shallow spawn tree with
+ * short leaves run on many workers moves fibers between the per-worker and
+ * global fiber pools as fast as the scheduler allows.  Run with
+ * CILK_ALERT=fiber_summary to see the pool high watermarks.
+ *
+long churn(long lo, long hi, long work) {
+    if (hi - lo <= 1)
+        return spin(work);
+
+    long mid = lo + (hi - lo) / 2;
+    long x = cilk_spawn churn(lo, mid, work);
+    long y = churn(mid, hi, work);
+    cilk_sync;
+
+    return x + y;
+}
+*/
+
+extern size_t ZERO;
+void __attribute__((weak)) dummy(void *p) { return; }
+
+static long __attribute__((noinline)) spin(long work) {
+    volatile long sink = 0;
+    for (long i = 0; i < work; i++)
+        sink += i;
+    return 1;
+}
+
+static void __attribute__ ((noinline))
+churn_spawn_helper(long *x, long lo, long hi, long work,
+                   __cilkrts_stack_frame *parent);
+
+static long churn(long lo, long hi, long work) {
+    long x = 0, y, _tmp;
+
+    if (hi - lo <= 1)
+        return spin(work);
+
+    dummy(alloca(ZERO));
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame(&sf);
+
+    long mid = lo + (hi - lo) / 2;
+
+    /* x = spawn churn(lo, mid, work) */
+    if (!__cilk_prepare_spawn(&sf)) {
+        churn_spawn_helper(&x, lo, mid, work, &sf);
+    }
+
+    y = churn(mid, hi, work);
+
+    /* cilk_sync */
+    __cilk_sync_nothrow(&sf);
+    _tmp = x + y;
+
+    __cilk_parent_epilogue(&sf);
+
+    return _tmp;
+}
+
+static void __attribute__ ((noinline))
+churn_spawn_helper(long *x, long lo, long hi, long work,
+                   __cilkrts_stack_frame *parent) {
+
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame_helper(&sf, parent, false);
+    __cilkrts_detach(&sf, parent);
+    *x = churn(lo, hi, work);
+    __cilk_helper_epilogue(&sf, parent, false);
+}
+
+const char *specifiers[] = {"-n", "-w", "-r", "-h", 0};
+int opt_types[] = {LONGARG, LONGARG, LONGARG, BOOLARG, 0};
+
+int main(int argc, char *argv[]) {
+    long leaves, work, rounds, res = 0;
+    int help;
+    clockmark_t begin, end;
+    uint64_t running_time[TIMING_COUNT];
+
+    /* standard benchmark options */
+    leaves = 1 << 20;
+    work = 64;
+    rounds = 10;
+    help = 0;
+
+    get_options(argc, argv, specifiers, opt_types, &leaves, &work, &rounds,
+                &help);
+
+    if (help) {
+        fprintf(stderr, "Usage: fiber_churn [cilk options] -n <leaves> "
+                        "-w <work> -r <rounds> [-h]\n");
+        fprintf(stderr, "   -n number of leaves in the spawn tree.\n");
+        fprintf(stderr, "   -w spin iterations per leaf.\n");
+        fprintf(stderr, "   -r number of spawn trees per timed run.\n");
+        exit(0);
+    }
+
+    for (int i = 0; i < TIMING_COUNT; i++) {
+        begin = ktiming_getmark();
+        res = 0;
+        for (long r = 0; r < rounds; r++)
+            res += churn(0, leaves, work);
+        end = ktiming_getmark();
+        running_time[i] = ktiming_diff_nsec(&begin, &end);
+    }
+    if (res != leaves * rounds) {
+        fprintf(stderr, "fiber_churn test FAILED: %ld leaves, expected %ld.\n",
+                res, leaves * rounds);
+        return 1;
+    }
+    printf("Result: %ld\n", res);
+    print_runtime(running_time, TIMING_COUNT);
+
+    return 0;
+}
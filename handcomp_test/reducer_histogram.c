@@ -0,0 +1,245 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cilk/cilk_api.h>
+
+#include "../runtime/cilk2c.h"
+#include "../runtime/cilk2c_inlined.c"
+#include "getoptions.h"
+#include "ktiming.h"
+
+#ifndef TIMING_COUNT
+#define TIMING_COUNT 1
+#endif
+
+/*
+ * Histogram reducer benchmark.  A parallel loop over n items counts them in
+ * the b bins of a histogram reducer, whose views are arrays of b longs, so
+ * reducing two views takes time proportional to b.  With -p, the reduce
+ * function is registered as parallel and adds the bins in parallel chunks;
+ * otherwise it adds them serially where the views meet.  The benchmark
+ * reports the longest stretch of reduction work done serially, which bounds
+ * how much reductions can add to the span.  With -z, the identity is
+ * registered as zeroing views, so large views are mapped on zero pages and
+ * only the bins the loop touched are added; compare a sparse histogram such
+ * as -n 65536 -b 4194304 with and without -z.  With -c, the reduce function
+ * is registered as commutative, so views are added together as soon as the
+ * strands holding them return, in any order.
+ *
+long cilk_reducer(zero, add) *hist;
+
+void count(long lo, long hi, long b) {
+    cilk_for (long i = lo; i < hi; i++)
+        hist[bin(i, b)] += 1;
+}
+*/
+
+#define REDUCE_CHUNK 4096
+
+extern size_t ZERO;
+void __attribute__((weak)) dummy(void *p) { return; }
+
+static long *hist;
+static long bins;
+static _Atomic uint64_t longest_reduce;
+
+static void note_reduce_time(clockmark_t *begin) {
+    clockmark_t end = ktiming_getmark();
+    uint64_t t = ktiming_diff_nsec(begin, &end);
+    uint64_t longest = atomic_load(&longest_reduce);
+    while (t > longest &&
+           !atomic_compare_exchange_weak(&longest_reduce, &longest, t))
+        ;
+}
+
+static void zero(void *v) { memset(v, 0, bins * sizeof(long)); }
+
+static void add_serial(long *l, const long *r, long lo, long hi) {
+    clockmark_t begin = ktiming_getmark();
+    for (long i = lo; i < hi; i++)
+        l[i] += r[i];
+    note_reduce_time(&begin);
+}
+
+static void __attribute__((noinline))
+add_spawn_helper(long *l, long *r, long lo, long hi,
+                 __cilkrts_stack_frame *parent);
+
+static void add_parallel(long *l, long *r, long lo, long hi) {
+    if (hi - lo <= REDUCE_CHUNK) {
+        add_serial(l, r, lo, hi);
+        return;
+    }
+
+    dummy(alloca(ZERO));
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame(&sf);
+
+    long mid = lo + (hi - lo) / 2;
+
+    /* spawn add_parallel(l, r, lo, mid) */
+    if (!__cilk_prepare_spawn(&sf)) {
+        add_spawn_helper(l, r, lo, mid, &sf);
+    }
+
+    add_parallel(l, r, mid, hi);
+
+    /* cilk_sync */
+    __cilk_sync_nothrow(&sf);
+
+    __cilk_parent_epilogue(&sf);
+}
+
+static void __attribute__((noinline))
+add_spawn_helper(long *l, long *r, long lo, long hi,
+                 __cilkrts_stack_frame *parent) {
+
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame_helper(&sf, parent, false);
+    __cilkrts_detach(&sf, parent);
+    add_parallel(l, r, lo, hi);
+    __cilk_helper_epilogue(&sf, parent, false);
+}
+
+static void add(void *l, void *r) { add_serial(l, r, 0, bins); }
+
+static void add_chunks(void *l, void *r) { add_parallel(l, r, 0, bins); }
+
+static void add_range(void *l, void *r, size_t offset, size_t size) {
+    add_serial(l, r, offset / sizeof(long), (offset + size) / sizeof(long));
+}
+
+static void add_range_chunks(void *l, void *r, size_t offset, size_t size) {
+    add_parallel(l, r, offset / sizeof(long), (offset + size) / sizeof(long));
+}
+
+static inline long bin(long i, long b) {
+    return (unsigned long)i * 0x9e3779b97f4a7c15UL % b;
+}
+
+static __cilk_reduce_fn reduce;
+
+static void count_leaf(long lo, long hi, long b) {
+    long *view = __cilkrts_reducer_lookup(hist, b * sizeof(long), zero, reduce);
+    for (long i = lo; i < hi; i++)
+        view[bin(i, b)] += 1;
+}
+
+static void __attribute__((noinline))
+count_spawn_helper(long lo, long hi, long b, __cilkrts_stack_frame *parent);
+
+static void count(long lo, long hi, long b) {
+    if (hi - lo <= 1024) {
+        count_leaf(lo, hi, b);
+        return;
+    }
+
+    dummy(alloca(ZERO));
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame(&sf);
+
+    long mid = lo + (hi - lo) / 2;
+
+    /* spawn count(lo, mid, b) */
+    if (!__cilk_prepare_spawn(&sf)) {
+        count_spawn_helper(lo, mid, b, &sf);
+    }
+
+    count(mid, hi, b);
+
+    /* cilk_sync */
+    __cilk_sync_nothrow(&sf);
+
+    __cilk_parent_epilogue(&sf);
+}
+
+static void __attribute__((noinline))
+count_spawn_helper(long lo, long hi, long b, __cilkrts_stack_frame *parent) {
+
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame_helper(&sf, parent, false);
+    __cilkrts_detach(&sf, parent);
+    count(lo, hi, b);
+    __cilk_helper_epilogue(&sf, parent, false);
+}
+
+const char *specifiers[] = {"-n", "-b", "-p", "-z", "-c", "-h", 0};
+int opt_types[] = {LONGARG, LONGARG, BOOLARG, BOOLARG, BOOLARG, BOOLARG, 0};
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+
+int main(int argc, char *argv[]) {
+    long n, total = 0;
+    int parallel, zero_pages, commutative, help;
+    clockmark_t begin, end;
+    uint64_t running_time[TIMING_COUNT];
+
+    /* standard benchmark options */
+    n = 1 << 22;
+    bins = 1 << 18;
+    parallel = 0;
+    zero_pages = 0;
+    commutative = 0;
+    help = 0;
+
+    get_options(argc, argv, specifiers, opt_types, &n, &bins, &parallel,
+                &zero_pages, &commutative, &help);
+
+    if (help || n < 1 || bins < 1) {
+        fprintf(stderr, "Usage: reducer_histogram [cilk options] "
+                        "-n <items> -b <bins> [-p] [-z] [-c] [-h]\n");
+        fprintf(stderr, "   -n number of items to count.\n");
+        fprintf(stderr, "   -b number of histogram bins.\n");
+        fprintf(stderr, "   -p reduce views in parallel.\n");
+        fprintf(stderr, "   -z map large views on zero pages.\n");
+        fprintf(stderr, "   -c reduce views in any order.\n");
+        exit(0);
+    }
+
+    reduce = add;
+    if (parallel) {
+        reduce = add_chunks;
+        if (__cilkrts_reducer_set_parallel(reduce)) {
+            fprintf(stderr, "Failed to register parallel reduce.\n");
+            return 1;
+        }
+    }
+    if (commutative && __cilkrts_reducer_set_commutative(reduce)) {
+        fprintf(stderr, "Failed to register commutative reduce.\n");
+        return 1;
+    }
+    if (zero_pages &&
+        __cilkrts_reducer_set_zero_identity(
+            zero, parallel ? add_range_chunks : add_range)) {
+        fprintf(stderr, "Failed to register zero identity.\n");
+        return 1;
+    }
+    hist = calloc(bins, sizeof(long));
+    __cilkrts_reducer_register(hist, bins * sizeof(long), zero, reduce);
+    for (int i = 0; i < TIMING_COUNT; i++) {
+        begin = ktiming_getmark();
+        count(0, n, bins);
+        end = ktiming_getmark();
+        running_time[i] = ktiming_diff_nsec(&begin, &end);
+    }
+    __cilkrts_reducer_unregister(hist);
+    for (long i = 0; i < bins; i++)
+        total += hist[i];
+    free(hist);
+    if (total != TIMING_COUNT * n) {
+        fprintf(stderr, "reducer_histogram test FAILED: %ld items counted, "
+                        "expected %ld.\n", total, TIMING_COUNT * n);
+        return 1;
+    }
+    printf("Result: %ld\n", total);
+    printf("Longest serial reduce: %.1f us\n",
+           (double)atomic_load(&longest_reduce) / 1000);
+    print_runtime(running_time, TIMING_COUNT);
+
+    return 0;
+}
+
+#pragma GCC diagnostic pop
@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <cilk/cilk_api.h>
+
+#include "../runtime/cilk2c.h"
+#include "../runtime/cilk2c_inlined.c"
+#include "getoptions.h"
+#include "ktiming.h"
+
+#ifndef TIMING_COUNT
+#define TIMING_COUNT 1
+#endif
+
+/*
+ * Reducer lookup microbenchmark.  Each iteration of a parallel loop updates
+ * the views of r live reducers in turn, k times, so the loop is dominated by
+ * the cost of looking up views.  Compare -r 1, 4 and 64.  With -H, each
+ * iteration takes a view handle on every reducer once and hoists the lookups
+ * out of its inner loop.
+ *
+long cilk_reducer(zero, plus) *sums;
+
+void update(long lo, long hi, long k, long r) {
+    cilk_for (long i = lo; i < hi; i++) {
+        long s = i % r;
+        for (long j = 0; j < k; j++) {
+            sums[s] += 1;
+            if (++s == r)
+                s = 0;
+        }
+    }
+}
+*/
+
+extern size_t ZERO;
+void __attribute__((weak)) dummy(void *p) { return; }
+
+static long *sums;
+
+static void zero(void *v) { *(long *)v = 0; }
+static void plus(void *l, void *r) { *(long *)l += *(long *)r; }
+
+static int hoist;
+
+static void update_leaf(long i, long k, long r) {
+    long s = i % r;
+    if (hoist) {
+        __cilkrts_view_handle h[r];
+        for (long t = 0; t < r; t++)
+            h[t] = __cilkrts_reducer_handle(&sums[t], sizeof(long), zero,
+                                            plus);
+        for (long j = 0; j < k; j++) {
+            *(long *)__cilkrts_handle_view(h[s]) += 1;
+            if (++s == r)
+                s = 0;
+        }
+        return;
+    }
+    for (long j = 0; j < k; j++) {
+        long *view = __cilkrts_reducer_lookup(&sums[s], sizeof(long), zero,
+                                              plus);
+        *view += 1;
+        if (++s == r)
+            s = 0;
+    }
+}
+
+static void __attribute__((noinline))
+update_spawn_helper(long lo, long hi, long k, long r,
+                    __cilkrts_stack_frame *parent);
+
+static void update(long lo, long hi, long k, long r) {
+    if (hi - lo <= 1) {
+        update_leaf(lo, k, r);
+        return;
+    }
+
+    dummy(alloca(ZERO));
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame(&sf);
+
+    long mid = lo + (hi - lo) / 2;
+
+    /* spawn update(lo, mid, k, r) */
+    if (!__cilk_prepare_spawn(&sf)) {
+        update_spawn_helper(lo, mid, k, r, &sf);
+    }
+
+    update(mid, hi, k, r);
+
+    /* cilk_sync */
+    __cilk_sync_nothrow(&sf);
+
+    __cilk_parent_epilogue(&sf);
+}
+
+static void __attribute__((noinline))
+update_spawn_helper(long lo, long hi, long k, long r,
+                    __cilkrts_stack_frame *parent) {
+
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame_helper(&sf, parent, false);
+    __cilkrts_detach(&sf, parent);
+    update(lo, hi, k, r);
+    __cilk_helper_epilogue(&sf, parent, false);
+}
+
+const char *specifiers[] = {"-n", "-k", "-r", "-H", "-h", 0};
+int opt_types[] = {LONGARG, LONGARG, LONGARG, BOOLARG, BOOLARG, 0};
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+
+int main(int argc, char *argv[]) {
+    long n, k, r, total = 0;
+    int help;
+    clockmark_t begin, end;
+    uint64_t running_time[TIMING_COUNT], best = UINT64_MAX;
+
+    /* standard benchmark options */
+    n = 1 << 12;
+    k = 4096;
+    r = 1;
+    help = 0;
+
+    get_options(argc, argv, specifiers, opt_types, &n, &k, &r, &hoist, &help);
+
+    if (help || n < 1 || k < 1 || r < 1) {
+        fprintf(stderr, "Usage: reducer_lookup [cilk options] -n <iterations> "
+                        "-k <lookups> -r <reducers> [-H] [-h]\n");
+        fprintf(stderr, "   -n number of parallel loop iterations.\n");
+        fprintf(stderr, "   -k reducer lookups per iteration.\n");
+        fprintf(stderr, "   -r number of live reducers.\n");
+        fprintf(stderr, "   -H hoist lookups out of the loop with handles.\n");
+        exit(0);
+    }
+
+    sums = calloc(r, sizeof(*sums));
+    for (long s = 0; s < r; s++)
+        __cilkrts_reducer_register(&sums[s], sizeof(long), zero, plus);
+    for (int i = 0; i < TIMING_COUNT; i++) {
+        begin = ktiming_getmark();
+        update(0, n, k, r);
+        end = ktiming_getmark();
+        running_time[i] = ktiming_diff_nsec(&begin, &end);
+        if (running_time[i] < best)
+            best = running_time[i];
+    }
+    for (long s = 0; s < r; s++) {
+        __cilkrts_reducer_unregister(&sums[s]);
+        total += sums[s];
+    }
+    free(sums);
+    if (total != TIMING_COUNT * n * k) {
+        fprintf(stderr, "reducer_lookup test FAILED: sum %ld, expected %ld.\n",
+                total, TIMING_COUNT * n * k);
+        return 1;
+    }
+    printf("Result: %ld\n", total);
+    printf("Lookup: %.2f ns\n", (double)best / (n * k));
+    print_runtime(running_time, TIMING_COUNT);
+
+    return 0;
+}
+
+#pragma GCC diagnostic pop
@@ -0,0 +1,269 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <cilk/cilk_api.h>
+
+#include "../runtime/cilk2c.h"
+#include "../runtime/cilk2c_inlined.c"
+#include "getoptions.h"
+#include "ktiming.h"
+
+#ifndef TIMING_COUNT
+#define TIMING_COUNT 1
+#endif
+
+/*
+ * Numeric reducer benchmark.  A parallel loop over n items finds the least
+ * of a pseudorandom value of each item, and the item it belongs to, with an
+ * argmin reducer.  With -a, it instead adds the values into ARRAY_LEN bins
+ * with an array add reducer, whose views are 64-byte aligned and whose
+ * reduce function is a vectorizable loop.  With -w, it accumulates into
+ * per-worker slots instead, padded to cache lines and combined at the end,
+ * the usual hand-written alternative to a reducer.
+ *
+#include <cilk/array_reducer.h>
+#include <cilk/min_max_reducer.h>
+
+cilk::argmin_reducer<unsigned long, long> least;
+cilk::array_add_reducer<long, ARRAY_LEN> bins;
+
+void scan(long lo, long hi) {
+    cilk_for (long i = lo; i < hi; i++) {
+        least.update(i, value(i));
+        // or, with -a
+        bins[i % ARRAY_LEN] += value(i) & 0xff;
+    }
+}
+*/
+
+#define ARRAY_LEN 1024
+#define LEAF_SIZE 1024
+
+extern size_t ZERO;
+void __attribute__((weak)) dummy(void *p) { return; }
+
+static inline unsigned long value(long i) {
+    unsigned long x = (unsigned long)(i + 1) * 0x9e3779b97f4a7c15UL;
+    return x ^ (x >> 29);
+}
+
+// The views of cilk::argmin_reducer<unsigned long, long> and
+// cilk::array_add_reducer<long, ARRAY_LEN>, and their identity and reduce
+// functions as the headers define them.
+typedef struct {
+    unsigned long value;
+    long index;
+} argmin_view;
+
+typedef struct {
+    _Alignas(64) long elems[ARRAY_LEN];
+} array_view;
+
+static void argmin_identity(void *v) {
+    argmin_view *view = v;
+    view->value = ULONG_MAX;
+    view->index = 0;
+}
+
+static void argmin_reduce(void *l, void *r) {
+    argmin_view *left = l, *right = r;
+    if (right->value < left->value)
+        *left = *right;
+}
+
+static void array_zero(void *v) {
+    long *restrict elems = __builtin_assume_aligned(v, 64);
+    for (long i = 0; i < ARRAY_LEN; ++i)
+        elems[i] = 0;
+}
+
+static void array_plus(void *l, void *r) {
+    long *restrict left = __builtin_assume_aligned(l, 64);
+    const long *restrict right = __builtin_assume_aligned(r, 64);
+    for (long i = 0; i < ARRAY_LEN; ++i)
+        left[i] += right[i];
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+
+// Per-worker accumulators, each on its own cache lines.
+typedef struct {
+    _Alignas(128) argmin_view view;
+} argmin_slot;
+
+static argmin_view least;
+static array_view bins;
+static argmin_slot *least_slots;
+static array_view *bins_slots;
+static int use_array, per_worker;
+
+static void scan_leaf(long lo, long hi) {
+    if (use_array) {
+        array_view *view =
+            per_worker ? &bins_slots[__cilkrts_get_worker_number()]
+                       : __cilkrts_reducer_lookup(&bins, sizeof(array_view),
+                                                  array_zero, array_plus);
+        for (long i = lo; i < hi; i++)
+            view->elems[i % ARRAY_LEN] += value(i) & 0xff;
+        return;
+    }
+    argmin_view *view =
+        per_worker ? &least_slots[__cilkrts_get_worker_number()].view
+                   : __cilkrts_reducer_lookup(&least, sizeof(argmin_view),
+                                              argmin_identity, argmin_reduce);
+    for (long i = lo; i < hi; i++) {
+        unsigned long v = value(i);
+        if (v < view->value) {
+            view->value = v;
+            view->index = i;
+        }
+    }
+}
+
+static void __attribute__((noinline))
+scan_spawn_helper(long lo, long hi, __cilkrts_stack_frame *parent);
+
+static void scan(long lo, long hi) {
+    if (hi - lo <= LEAF_SIZE) {
+        scan_leaf(lo, hi);
+        return;
+    }
+
+    dummy(alloca(ZERO));
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame(&sf);
+
+    long mid = lo + (hi - lo) / 2;
+
+    /* spawn scan(lo, mid) */
+    if (!__cilk_prepare_spawn(&sf)) {
+        scan_spawn_helper(lo, mid, &sf);
+    }
+
+    scan(mid, hi);
+
+    /* cilk_sync */
+    __cilk_sync_nothrow(&sf);
+
+    __cilk_parent_epilogue(&sf);
+}
+
+static void __attribute__((noinline))
+scan_spawn_helper(long lo, long hi, __cilkrts_stack_frame *parent) {
+
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame_helper(&sf, parent, false);
+    __cilkrts_detach(&sf, parent);
+    scan(lo, hi);
+    __cilk_helper_epilogue(&sf, parent, false);
+}
+
+// Combine the per-worker accumulators into the leftmost views.  Per-worker
+// slots do not keep the serial order of the items, so ties in the argmin
+// are broken by index.
+static void combine_slots(unsigned nworkers) {
+    for (unsigned w = 0; w < nworkers; w++) {
+        if (use_array) {
+            array_plus(&bins, &bins_slots[w]);
+            array_zero(&bins_slots[w]);
+            continue;
+        }
+        argmin_view *view = &least_slots[w].view;
+        if (view->value < least.value ||
+            (view->value == least.value && view->index < least.index))
+            least = *view;
+        argmin_identity(view);
+    }
+}
+
+const char *specifiers[] = {"-n", "-a", "-w", "-h", 0};
+int opt_types[] = {LONGARG, BOOLARG, BOOLARG, BOOLARG, 0};
+
+int main(int argc, char *argv[]) {
+    long n;
+    int help;
+    clockmark_t begin, end;
+    uint64_t running_time[TIMING_COUNT];
+
+    /* standard benchmark options */
+    n = 1 << 24;
+    use_array = 0;
+    per_worker = 0;
+    help = 0;
+
+    get_options(argc, argv, specifiers, opt_types, &n, &use_array,
+                &per_worker, &help);
+
+    if (help || n < 1) {
+        fprintf(stderr, "Usage: reducer_numeric [cilk options] -n <items> "
+                        "[-a] [-w] [-h]\n");
+        fprintf(stderr, "   -n number of items.\n");
+        fprintf(stderr, "   -a add into an array instead of finding a min.\n");
+        fprintf(stderr, "   -w accumulate per worker instead of in a "
+                        "reducer.\n");
+        exit(0);
+    }
+
+    unsigned nworkers = __cilkrts_get_nworkers();
+    least_slots = aligned_alloc(128, nworkers * sizeof(argmin_slot));
+    bins_slots = aligned_alloc(64, nworkers * sizeof(array_view));
+    for (unsigned w = 0; w < nworkers; w++) {
+        argmin_identity(&least_slots[w].view);
+        array_zero(&bins_slots[w]);
+    }
+    argmin_identity(&least);
+    array_zero(&bins);
+
+    if (!per_worker) {
+        if (use_array)
+            __cilkrts_reducer_register(&bins, sizeof(array_view), array_zero,
+                                       array_plus);
+        else
+            __cilkrts_reducer_register(&least, sizeof(argmin_view),
+                                       argmin_identity, argmin_reduce);
+    }
+    for (int i = 0; i < TIMING_COUNT; i++) {
+        begin = ktiming_getmark();
+        scan(0, n);
+        if (per_worker)
+            combine_slots(nworkers);
+        end = ktiming_getmark();
+        running_time[i] = ktiming_diff_nsec(&begin, &end);
+    }
+    if (!per_worker)
+        __cilkrts_reducer_unregister(use_array ? (void *)&bins
+                                               : (void *)&least);
+    free(least_slots);
+    free(bins_slots);
+
+    // Check against a serial loop.
+    argmin_view expect_least;
+    argmin_identity(&expect_least);
+    long expect_sum = 0, sum = 0;
+    for (long i = 0; i < n; i++) {
+        unsigned long v = value(i);
+        if (v < expect_least.value) {
+            expect_least.value = v;
+            expect_least.index = i;
+        }
+        expect_sum += v & 0xff;
+    }
+    for (long i = 0; i < ARRAY_LEN; i++)
+        sum += bins.elems[i];
+    if (use_array ? sum != TIMING_COUNT * expect_sum
+                  : least.index != expect_least.index) {
+        fprintf(stderr, "reducer_numeric test FAILED.\n");
+        return 1;
+    }
+    if (use_array)
+        printf("Result: %ld\n", sum);
+    else
+        printf("Result: %lu at %ld\n", least.value, least.index);
+    print_runtime(running_time, TIMING_COUNT);
+
+    return 0;
+}
+
+#pragma GCC diagnostic pop
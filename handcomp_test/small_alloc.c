@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <cilk/cilk_api.h>
+
+#include "../runtime/cilk2c.h"
+#include "../runtime/cilk2c_inlined.c"
+#include "getoptions.h"
+#include "ktiming.h"
+
+#ifndef TIMING_COUNT
+#define TIMING_COUNT 1
+#endif
+
+/*
+ * Small-object allocation microbenchmark.  A parallel loop builds one linked
+ * list of small nodes per iteration, and a second parallel loop, running
+ * over the iterations in reverse, frees them, so most nodes are freed by a
+ * different worker than the one that allocated them.  Compare the system
+ * malloc (-m 0) with cilk_malloc (-m 1).
+ *
+struct node { struct node *next; long val; };
+
+void build(long lo, long hi, long k, size_t size) {
+    cilk_for (long i = lo; i < hi; i++) {
+        struct node *head = NULL;
+        for (long j = 0; j < k; j++) {
+            struct node *n = ALLOC(size);
+            n->next = head;
+            n->val = j;
+            head = n;
+        }
+        lists[i] = head;
+    }
+}
+
+void destroy(long lo, long hi, size_t size) {
+    cilk_for (long i = lo; i < hi; i++) {
+        struct node *n = lists[hi - 1 - i];
+        while (n) {
+            struct node *next = n->next;
+            FREE(n, size);
+            n = next;
+        }
+    }
+}
+*/
+
+struct node {
+    struct node *next;
+    long val;
+};
+
+extern size_t ZERO;
+void __attribute__((weak)) dummy(void *p) { return; }
+
+static struct node **lists;
+static int use_cilk_malloc;
+
+static inline void *alloc_node(size_t size) {
+    return use_cilk_malloc ? cilk_malloc(size) : malloc(size);
+}
+
+static inline void free_node(void *p, size_t size) {
+    if (use_cilk_malloc)
+        cilk_free(p, size);
+    else
+        free(p);
+}
+
+static void build_leaf(long i, long k, size_t size) {
+    struct node *head = NULL;
+    for (long j = 0; j < k; j++) {
+        struct node *n = alloc_node(size);
+        n->next = head;
+        n->val = j;
+        head = n;
+    }
+    lists[i] = head;
+}
+
+static long destroy_leaf(long i, size_t size) {
+    long sum = 0;
+    struct node *n = lists[i];
+    while (n) {
+        struct node *next = n->next;
+        sum += n->val;
+        free_node(n, size);
+        n = next;
+    }
+    lists[i] = NULL;
+    return sum;
+}
+
+static void __attribute__((noinline))
+build_spawn_helper(long lo, long hi, long k, size_t size,
+                   __cilkrts_stack_frame *parent);
+
+static void build(long lo, long hi, long k, size_t size) {
+    if (hi - lo <= 1) {
+        build_leaf(lo, k, size);
+        return;
+    }
+
+    dummy(alloca(ZERO));
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame(&sf);
+
+    long mid = lo + (hi - lo) / 2;
+
+    /* spawn build(lo, mid, k, size) */
+    if (!__cilk_prepare_spawn(&sf)) {
+        build_spawn_helper(lo, mid, k, size, &sf);
+    }
+
+    build(mid, hi, k, size);
+
+    /* cilk_sync */
+    __cilk_sync_nothrow(&sf);
+
+    __cilk_parent_epilogue(&sf);
+}
+
+static void __attribute__((noinline))
+build_spawn_helper(long lo, long hi, long k, size_t size,
+                   __cilkrts_stack_frame *parent) {
+
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame_helper(&sf, parent, false);
+    __cilkrts_detach(&sf, parent);
+    build(lo, hi, k, size);
+    __cilk_helper_epilogue(&sf, parent, false);
+}
+
+static void __attribute__((noinline))
+destroy_spawn_helper(long *x, long lo, long hi, long n, size_t size,
+                     __cilkrts_stack_frame *parent);
+
+/* Free the lists of iterations lo to hi - 1, counted from the end. */
+static long destroy(long lo, long hi, long n, size_t size) {
+    long x = 0, y, _tmp;
+
+    if (hi - lo <= 1)
+        return destroy_leaf(n - 1 - lo, size);
+
+    dummy(alloca(ZERO));
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame(&sf);
+
+    long mid = lo + (hi - lo) / 2;
+
+    /* x = spawn destroy(lo, mid, n, size) */
+    if (!__cilk_prepare_spawn(&sf)) {
+        destroy_spawn_helper(&x, lo, mid, n, size, &sf);
+    }
+
+    y = destroy(mid, hi, n, size);
+
+    /* cilk_sync */
+    __cilk_sync_nothrow(&sf);
+    _tmp = x + y;
+
+    __cilk_parent_epilogue(&sf);
+
+    return _tmp;
+}
+
+static void __attribute__((noinline))
+destroy_spawn_helper(long *x, long lo, long hi, long n, size_t size,
+                     __cilkrts_stack_frame *parent) {
+
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame_helper(&sf, parent, false);
+    __cilkrts_detach(&sf, parent);
+    *x = destroy(lo, hi, n, size);
+    __cilk_helper_epilogue(&sf, parent, false);
+}
+
+const char *specifiers[] = {"-n", "-k", "-s", "-m", "-h", 0};
+int opt_types[] = {LONGARG, LONGARG, LONGARG, INTARG, BOOLARG, 0};
+
+int main(int argc, char *argv[]) {
+    long n, k, size, res = 0;
+    int help;
+    clockmark_t begin, end;
+    uint64_t running_time[TIMING_COUNT];
+
+    /* standard benchmark options */
+    n = 1 << 12;
+    k = 256;
+    size = sizeof(struct node);
+    use_cilk_malloc = 1;
+    help = 0;
+
+    get_options(argc, argv, specifiers, opt_types, &n, &k, &size,
+                &use_cilk_malloc, &help);
+
+    if (help || size < (long)sizeof(struct node)) {
+        fprintf(stderr, "Usage: small_alloc [cilk options] -n <iterations> "
+                        "-k <nodes> -s <size> -m <0|1> [-h]\n");
+        fprintf(stderr, "   -n number of parallel loop iterations.\n");
+        fprintf(stderr, "   -k nodes allocated per iteration.\n");
+        fprintf(stderr, "   -s node size in bytes, at least %zu.\n",
+                sizeof(struct node));
+        fprintf(stderr, "   -m 0 for malloc, 1 for cilk_malloc.\n");
+        exit(0);
+    }
+
+    lists = calloc(n, sizeof(*lists));
+    for (int i = 0; i < TIMING_COUNT; i++) {
+        begin = ktiming_getmark();
+        build(0, n, k, size);
+        res = destroy(0, n, n, size);
+        end = ktiming_getmark();
+        running_time[i] = ktiming_diff_nsec(&begin, &end);
+    }
+    free(lists);
+    if (res != n * (k * (k - 1) / 2)) {
+        fprintf(stderr, "small_alloc test FAILED: sum %ld, expected %ld.\n",
+                res, n * (k * (k - 1) / 2));
+        return 1;
+    }
+    printf("Result: %ld\n", res);
+    print_runtime(running_time, TIMING_COUNT);
+
+    return 0;
+}
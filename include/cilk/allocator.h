@@ -0,0 +1,51 @@
+#ifndef _CILK_ALLOCATOR_H
+#define _CILK_ALLOCATOR_H
+
+#ifdef __cplusplus
+
+#include <cilk/cilk_api.h>
+#include <cstddef>
+#include <new>
+
+namespace cilk {
+
+// Standard allocator that takes objects from the per-worker memory pools of
+// the Cilk runtime, e.g., for the nodes of containers built in parallel.
+template <typename T> struct allocator {
+    static_assert(alignof(T) <= alignof(std::max_align_t),
+                  "cilk::allocator does not support over-aligned types");
+
+    using value_type = T;
+
+    allocator() noexcept = default;
+    template <typename U> allocator(const allocator<U> &) noexcept {}
+
+    T *allocate(std::size_t n) {
+        if (n > static_cast<std::size_t>(-1) / sizeof(T))
+            throw std::bad_array_new_length();
+        void *p = cilk_malloc(n * sizeof(T));
+        if (!p)
+            throw std::bad_alloc();
+        return static_cast<T *>(p);
+    }
+
+    void deallocate(T *p, std::size_t n) noexcept {
+        cilk_free(p, n * sizeof(T));
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const allocator<T> &, const allocator<U> &) noexcept {
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const allocator<T> &, const allocator<U> &) noexcept {
+    return false;
+}
+
+} // namespace cilk
+
+#endif // __cplusplus
+
+#endif // _CILK_ALLOCATOR_H
@@ -0,0 +1,116 @@
+#ifndef _ARRAY_REDUCER_H
+#define _ARRAY_REDUCER_H
+
+#ifdef __cplusplus
+
+#include <cilk/min_max_reducer.h> // greatest, least
+#include <cstddef>
+#include <type_traits>
+
+// Ask the vectorizer for the loops reducing arrays.  Their bounds are
+// constants and their operands are aligned and do not alias, so it needs no
+// runtime checks.
+#ifdef __clang__
+#define __CILK_VECTORIZE_LOOP                                                  \
+    _Pragma("clang loop vectorize(enable) interleave(enable)")
+#else
+#define __CILK_VECTORIZE_LOOP
+#endif
+
+namespace cilk {
+
+// A view of N elements of type T, aligned to 64 bytes so that whole cache
+// lines and vector registers can be loaded from it.
+template <typename T, std::size_t N> struct alignas(64) array_view {
+    static_assert(std::is_arithmetic<T>::value,
+                  "cilk::array_view holds arithmetic types");
+
+    T elems[N];
+
+    T &operator[](std::size_t i) { return elems[i]; }
+    const T &operator[](std::size_t i) const { return elems[i]; }
+    T *data() { return elems; }
+    const T *data() const { return elems; }
+    static constexpr std::size_t size() { return N; }
+};
+
+template <typename T> static inline T *aligned_elems(void *v) {
+    return static_cast<T *>(__builtin_assume_aligned(v, 64));
+}
+
+template <typename T, std::size_t N>
+static inline void array_fill(void *v, T value) {
+    T *__restrict__ elems = aligned_elems<T>(v);
+    __CILK_VECTORIZE_LOOP
+    for (std::size_t i = 0; i < N; ++i)
+        elems[i] = value;
+}
+
+template <typename T, std::size_t N> static void array_zero(void *v) {
+    array_fill<T, N>(v, static_cast<T>(0));
+}
+
+template <typename T, std::size_t N> static void array_min_identity(void *v) {
+    array_fill<T, N>(v, greatest<T>());
+}
+
+template <typename T, std::size_t N> static void array_max_identity(void *v) {
+    array_fill<T, N>(v, least<T>());
+}
+
+template <typename T, std::size_t N>
+static void array_plus(void *l, void *r) {
+    T *__restrict__ left = aligned_elems<T>(l);
+    const T *__restrict__ right = aligned_elems<T>(r);
+    __CILK_VECTORIZE_LOOP
+    for (std::size_t i = 0; i < N; ++i)
+        left[i] += right[i];
+}
+
+template <typename T, std::size_t N>
+static void array_min(void *l, void *r) {
+    T *__restrict__ left = aligned_elems<T>(l);
+    const T *__restrict__ right = aligned_elems<T>(r);
+    __CILK_VECTORIZE_LOOP
+    for (std::size_t i = 0; i < N; ++i)
+        left[i] = right[i] < left[i] ? right[i] : left[i];
+}
+
+template <typename T, std::size_t N>
+static void array_max(void *l, void *r) {
+    T *__restrict__ left = aligned_elems<T>(l);
+    const T *__restrict__ right = aligned_elems<T>(r);
+    __CILK_VECTORIZE_LOOP
+    for (std::size_t i = 0; i < N; ++i)
+        left[i] = left[i] < right[i] ? right[i] : left[i];
+}
+
+// Add the bytes [offset, offset + size) of right to left, for registering
+// array_zero<T, N> with __cilkrts_reducer_set_zero_identity, so that large
+// views start out on zero pages and only the pages touched are added.
+template <typename T, std::size_t N>
+static void array_plus_range(void *l, void *r, std::size_t offset,
+                             std::size_t size) {
+    T *__restrict__ left = static_cast<T *>(l) + offset / sizeof(T);
+    const T *__restrict__ right = static_cast<T *>(r) + offset / sizeof(T);
+    for (std::size_t i = 0; i < size / sizeof(T); ++i)
+        left[i] += right[i];
+}
+
+template <typename T, std::size_t N>
+using array_add_reducer =
+    array_view<T, N> _Hyperobject(array_zero<T, N>, array_plus<T, N>);
+
+template <typename T, std::size_t N>
+using array_min_reducer =
+    array_view<T, N> _Hyperobject(array_min_identity<T, N>, array_min<T, N>);
+
+template <typename T, std::size_t N>
+using array_max_reducer =
+    array_view<T, N> _Hyperobject(array_max_identity<T, N>, array_max<T, N>);
+
+} // namespace cilk
+
+#endif // #ifdef __cplusplus
+
+#endif // _ARRAY_REDUCER_H
@@ -0,0 +1,39 @@
+#ifndef _BITWISE_REDUCER_H
+#define _BITWISE_REDUCER_H
+
+#ifdef __cplusplus
+
+#include <cilk/opadd_reducer.h> // zero
+
+namespace cilk {
+
+template <typename T> static void all_ones(void *v) {
+    *static_cast<T *>(v) = static_cast<T>(~static_cast<T>(0));
+}
+
+template <typename T> static void op_and(void *l, void *r) {
+    *static_cast<T *>(l) &= *static_cast<T *>(r);
+}
+
+template <typename T> static void op_or(void *l, void *r) {
+    *static_cast<T *>(l) |= *static_cast<T *>(r);
+}
+
+template <typename T> static void op_xor(void *l, void *r) {
+    *static_cast<T *>(l) ^= *static_cast<T *>(r);
+}
+
+template <typename T>
+using opand_reducer = T _Hyperobject(all_ones<T>, op_and<T>);
+
+template <typename T>
+using opor_reducer = T _Hyperobject(zero<T>, op_or<T>);
+
+template <typename T>
+using opxor_reducer = T _Hyperobject(zero<T>, op_xor<T>);
+
+} // namespace cilk
+
+#endif // #ifdef __cplusplus
+
+#endif // _BITWISE_REDUCER_H
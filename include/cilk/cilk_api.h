@@ -28,8 +28,31 @@ void __cilkrts_dprand_set_seed(uint64_t seed);
 void __cilkrts_init_dprng(void);
 uint64_t __cilkrts_get_dprand(void);
 
+/* Stack-size classes for the fibers that run Cilk code.  The default class
+   uses the stack size set by CILK_STACKSIZE; the small and large classes use
+   stacks 8 times smaller and larger, within the limits of the runtime. */
+enum __cilkrts_stack_size_class {
+    __cilkrts_stack_default = 0,
+    __cilkrts_stack_small = 1,
+    __cilkrts_stack_large = 2,
+};
+/* Select the stack-size class for subsequent cilkified regions.  Call it
+   only between regions: it returns -1 without changing the class while a
+   region is running.  Returns the previous class, or -1 on error. */
+int __cilkrts_set_stack_size_class(enum __cilkrts_stack_size_class);
+
+/* Small-object allocator backed by per-worker memory pools.  Memory may be
+   freed by any worker, or outside Cilk code, and cilk_free must be given the
+   size passed to cilk_malloc.  Blocks are aligned like malloc's.  Any
+   thread may call these, inside or outside of Cilkified regions.
+   Large blocks, and blocks allocated before the runtime starts, come from
+   malloc, and cilk_free returns them to it. */
+void *cilk_malloc(size_t size) __attribute__((malloc, alloc_size(1)));
+void cilk_free(void *ptr, size_t size);
+
 typedef void (*__cilk_identity_fn)(void *);
 typedef void (*__cilk_reduce_fn)(void *, void *);
+typedef void (*__cilk_reduce_range_fn)(void *, void *, size_t, size_t);
 
 /* void *__cilkrts_reducer_lookup(void *key); */
 
@@ -41,6 +64,67 @@ void __cilkrts_reducer_register(void *key, size_t size, __cilk_identity_fn id,
     __attribute__((deprecated));
 void __cilkrts_reducer_unregister(void *key) __attribute__((deprecated));
 
+/* Register reduce as a parallel reduce function, which may use cilk_spawn
+   and cilk_for.  The runtime then does not run reductions with it where the
+   views of two strands meet, which is on the critical path of a join, but
+   defers them to the next lookup of the reducer, or the end of the Cilkified
+   region, which run them in Cilk code.  Only the reduction of each such
+   reducer can spawn: the views of the many reducers of one strand are still
+   merged one reducer after another.  Register a reduce function before the
+   first lookup of a reducer using it.  Returns 0, or -1 if too many reduce
+   functions are registered. */
+int __cilkrts_reducer_set_parallel(__cilk_reduce_fn reduce);
+
+/* Register reduce as a commutative reduce function, e.g., one adding sums
+   or counts.  The runtime then reduces the views of reducers using it in any
+   order: as a strand returns, its views are folded into the views its
+   finished siblings left, rather than held until the siblings between them
+   finish.  Register a reduce function before the first lookup of a reducer
+   using it.  Returns 0, or -1 if too many reduce functions are
+   registered. */
+int __cilkrts_reducer_set_commutative(__cilk_reduce_fn reduce);
+
+/* Register identity as an identity function that zeroes views, and
+   reduce_range(left, right, offset, size) as reducing the bytes [offset,
+   offset + size) of the view right into those of the view left.  The runtime
+   then maps large views of reducers using identity on fresh zero pages
+   instead of initializing them, and reduces them by calling reduce_range on
+   the runs of pages the program touched, skipping the rest.  Offsets are
+   multiples of the page size, so elements of views must not straddle pages.
+   Register identity before the first lookup of a reducer using it.  Returns
+   0, or -1 if too many identity functions are registered. */
+int __cilkrts_reducer_set_zero_identity(__cilk_identity_fn identity,
+                                        __cilk_reduce_range_fn reduce_range);
+
+/* A handle on the current strand's view of a reducer.  The view stays valid
+   until the next spawn, sync or return of the strand that took the handle,
+   so a lookup can be hoisted out of a loop that does none of those:
+
+     __cilkrts_view_handle h = __cilkrts_reducer_handle(&sum, ...);
+     for (...)
+         *(long *)__cilkrts_handle_view(h) += x;
+
+   Define CILK_CHECK_VIEW_HANDLES to make __cilkrts_handle_view abort when
+   a handle is used after its view has been reduced away or from a strand
+   that sees a different view, e.g., after the continuation was stolen. */
+typedef struct __cilkrts_view_handle {
+    void *view;
+    void *key;
+} __cilkrts_view_handle;
+void __cilkrts_check_view_handle(__cilkrts_view_handle h);
+static inline __cilkrts_view_handle
+__cilkrts_reducer_handle(void *key, size_t size, void *id, void *reduce) {
+    __cilkrts_view_handle h = {__cilkrts_reducer_lookup(key, size, id, reduce),
+                               key};
+    return h;
+}
+static inline void *__cilkrts_handle_view(__cilkrts_view_handle h) {
+#ifdef CILK_CHECK_VIEW_HANDLES
+    __cilkrts_check_view_handle(h);
+#endif
+    return h.view;
+}
+
 #ifdef __cplusplus
 }
 #endif
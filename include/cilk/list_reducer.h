@@ -0,0 +1,35 @@
+#ifndef _LIST_REDUCER_H
+#define _LIST_REDUCER_H
+
+#ifdef __cplusplus
+
+#include <list>
+#include <memory>
+#include <new>
+
+namespace cilk {
+
+template <typename List> static void list_identity(void *view) {
+    new (view) List();
+}
+
+template <typename List> static void list_splice(void *left_v, void *right_v) {
+    List *left = static_cast<List *>(left_v);
+    List *right = static_cast<List *>(right_v);
+    left->splice(left->end(), *right);
+    right->~List();
+}
+
+// A list that parallel strands append to, in serial order.  Reducing two
+// views splices their lists in constant time, which requires allocators that
+// compare equal, like std::allocator and cilk::allocator.
+template <typename T, typename Alloc = std::allocator<T>>
+using list_append_reducer = std::list<T, Alloc>
+    _Hyperobject(list_identity<std::list<T, Alloc>>,
+                 list_splice<std::list<T, Alloc>>);
+
+} // namespace cilk
+
+#endif // #ifdef __cplusplus
+
+#endif // _LIST_REDUCER_H
@@ -0,0 +1,113 @@
+#ifndef _MIN_MAX_REDUCER_H
+#define _MIN_MAX_REDUCER_H
+
+#ifdef __cplusplus
+
+#include <cstddef>
+#include <limits>
+#include <new>
+
+namespace cilk {
+
+// The greatest and least values of T, which are infinities if T has them.
+template <typename T> constexpr T greatest() {
+    return std::numeric_limits<T>::has_infinity
+               ? std::numeric_limits<T>::infinity()
+               : std::numeric_limits<T>::max();
+}
+
+template <typename T> constexpr T least() {
+    return std::numeric_limits<T>::has_infinity
+               ? -std::numeric_limits<T>::infinity()
+               : std::numeric_limits<T>::lowest();
+}
+
+template <typename T> static void min_identity(void *v) {
+    *static_cast<T *>(v) = greatest<T>();
+}
+
+template <typename T> static void max_identity(void *v) {
+    *static_cast<T *>(v) = least<T>();
+}
+
+template <typename T> static void min_reduce(void *l, void *r) {
+    T &left = *static_cast<T *>(l);
+    const T &right = *static_cast<T *>(r);
+    if (right < left)
+        left = right;
+}
+
+template <typename T> static void max_reduce(void *l, void *r) {
+    T &left = *static_cast<T *>(l);
+    const T &right = *static_cast<T *>(r);
+    if (left < right)
+        left = right;
+}
+
+template <typename T>
+using min_reducer = T _Hyperobject(min_identity<T>, min_reduce<T>);
+
+template <typename T>
+using max_reducer = T _Hyperobject(max_identity<T>, max_reduce<T>);
+
+// The least value passed to update, and the index passed along with it.  On
+// ties the earliest update wins, as in a serial loop, so the index is
+// deterministic.
+template <typename T, typename Index = std::size_t> struct argmin_view {
+    T value = greatest<T>();
+    Index index = Index();
+
+    void update(Index i, const T &v) {
+        if (v < value) {
+            value = v;
+            index = i;
+        }
+    }
+
+    static void identity(void *view) { new (view) argmin_view(); }
+
+    static void reduce(void *left_v, void *right_v) {
+        argmin_view *left = static_cast<argmin_view *>(left_v);
+        argmin_view *right = static_cast<argmin_view *>(right_v);
+        if (right->value < left->value)
+            *left = *right;
+    }
+};
+
+// The greatest value passed to update, and the index passed along with it.
+template <typename T, typename Index = std::size_t> struct argmax_view {
+    T value = least<T>();
+    Index index = Index();
+
+    void update(Index i, const T &v) {
+        if (value < v) {
+            value = v;
+            index = i;
+        }
+    }
+
+    static void identity(void *view) { new (view) argmax_view(); }
+
+    static void reduce(void *left_v, void *right_v) {
+        argmax_view *left = static_cast<argmax_view *>(left_v);
+        argmax_view *right = static_cast<argmax_view *>(right_v);
+        if (left->value < right->value)
+            *left = *right;
+    }
+};
+
+template <typename T, typename Index = std::size_t>
+using argmin_reducer = argmin_view<T, Index>
+    _Hyperobject(&argmin_view<T, Index>::identity,
+                 &argmin_view<T, Index>::reduce);
+
+template <typename T, typename Index = std::size_t>
+using argmax_reducer = argmax_view<T, Index>
+    _Hyperobject(&argmax_view<T, Index>::identity,
+                 &argmax_view<T, Index>::reduce);
+
+} // namespace cilk
+
+#endif // #ifdef __cplusplus
+
+#endif // _MIN_MAX_REDUCER_H
@@ -3,32 +3,167 @@
 
 #ifdef __cplusplus
 
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <list>
+#include <memory>
 #include <ostream>
-#include <sstream>
+#include <streambuf>
+#include <utility>
+#include <sys/uio.h>
 
 /* Adapted from Intel Cilk Plus */
 
 namespace cilk {
 
+// A stream buffer that appends output to a list of blocks.  Two buffers are
+// concatenated by splicing their lists in constant time, so reducing views
+// never copies their output; it is copied once more only where it is finally
+// written out.
+template <typename Char, typename Traits>
+class chain_buf : public std::basic_streambuf<Char, Traits>
+{
+    typedef std::basic_streambuf<Char, Traits> base;
+    typedef typename Traits::int_type int_type;
+
+    static const std::size_t block_chars = 4096 / sizeof(Char);
+
+    struct block {
+        std::unique_ptr<Char[]> data;
+        std::size_t size; // characters written
+    };
+
+    std::list<block> m_blocks;
+
+    // Record how much of the last block is written.
+    void sync_last() {
+        if (!m_blocks.empty())
+            m_blocks.back().size = base::pptr() - base::pbase();
+    }
+
+    // Continue writing after the output in the last block.
+    void resume_last() {
+        if (m_blocks.empty()) {
+            base::setp(nullptr, nullptr);
+            return;
+        }
+        block &b = m_blocks.back();
+        base::setp(b.data.get(), b.data.get() + block_chars);
+        base::pbump(static_cast<int>(b.size));
+    }
+
+protected:
+    int_type overflow(int_type c) override {
+        sync_last();
+        std::unique_ptr<Char[]> data(new Char[block_chars]);
+        m_blocks.push_back(block{std::move(data), 0});
+        resume_last();
+        if (!Traits::eq_int_type(c, Traits::eof())) {
+            *base::pptr() = Traits::to_char_type(c);
+            base::pbump(1);
+        }
+        return Traits::not_eof(c);
+    }
+
+public:
+    chain_buf() = default;
+    chain_buf(const chain_buf &) = delete;
+    chain_buf &operator=(const chain_buf &) = delete;
+
+    // Append the output of other to this buffer, leaving other empty.
+    void splice(chain_buf &other) {
+        sync_last();
+        other.sync_last();
+        m_blocks.splice(m_blocks.end(), other.m_blocks);
+        other.resume_last();
+        resume_last();
+    }
+
+    // Write the output to sb, leaving this buffer empty.
+    void drain(base *sb) {
+        sync_last();
+        for (const block &b : m_blocks)
+            sb->sputn(b.data.get(), static_cast<std::streamsize>(b.size));
+        m_blocks.clear();
+        resume_last();
+    }
+
+    // Write the output to the file descriptor fd, with one writev call for
+    // up to IOV_MAX blocks, leaving this buffer empty.  Returns false if a
+    // write fails.
+    bool drain(int fd) {
+#ifdef IOV_MAX
+        const int max_iov = IOV_MAX;
+#else
+        const int max_iov = 1024;
+#endif
+        sync_last();
+        bool ok = true;
+        auto it = m_blocks.begin();
+        std::size_t offset = 0; // bytes of *it written
+        while (it != m_blocks.end()) {
+            struct iovec iov[max_iov];
+            int n = 0;
+            for (auto b = it; b != m_blocks.end() && n < max_iov; ++b) {
+                std::size_t skip = b == it ? offset : 0;
+                if (b->size * sizeof(Char) == skip)
+                    continue;
+                char *bytes = reinterpret_cast<char *>(b->data.get());
+                iov[n].iov_base = bytes + skip;
+                iov[n].iov_len = b->size * sizeof(Char) - skip;
+                ++n;
+            }
+            if (n == 0)
+                break;
+            ssize_t written = writev(fd, iov, n);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written <= 0) {
+                ok = false;
+                break;
+            }
+            std::size_t rest = written;
+            while (it != m_blocks.end() &&
+                   rest >= it->size * sizeof(Char) - offset) {
+                rest -= it->size * sizeof(Char) - offset;
+                offset = 0;
+                ++it;
+            }
+            offset += rest;
+        }
+        m_blocks.clear();
+        resume_last();
+        return ok;
+    }
+};
+
 template<typename Char, typename Traits>
 class ostream_view : public std::basic_ostream<Char, Traits>
 {
     typedef std::basic_ostream<Char, Traits>  base;
     typedef std::basic_ostream<Char, Traits>  ostream_type;
 
-    // A non-leftmost view is associated with a private string buffer. (The
+    // A non-leftmost view is associated with a private chain of buffers. (The
     // leftmost view is associated with the buffer of the reducer's associated
     // ostream, so its private buffer is unused.)
     //
-    std::basic_stringbuf<Char, Traits> m_buffer;
+    chain_buf<Char, Traits> m_buffer;
+
+    bool is_leftmost() const
+    {
+        return base::rdbuf() != &m_buffer;
+    }
 
 public:
     void reduce(ostream_view* other)
     {
-        // Writing an empty buffer results in failure. Testing `sgetc()` is the
-        // easiest way of checking for an empty buffer.
-        if (other->m_buffer.sgetc() != Traits::eof()) {
-            *this << (&other->m_buffer);
+        // Splice the output of other after this view's, unless this view is
+        // the leftmost one, which writes it to the reducer's ostream.
+        if (is_leftmost()) {
+            other->m_buffer.drain(base::rdbuf());
+        } else {
+            m_buffer.splice(other->m_buffer);
         }
     }
 
@@ -64,8 +199,60 @@ public:
 
 template<typename Char, typename Traits = std::char_traits<Char>>
   using ostream_reducer = ostream_view<Char, Traits>
-    _Hyperobject(&ostream_view<char, std::char_traits<char>>::identity,
-                 &ostream_view<char, std::char_traits<char>>::reduce);
+    _Hyperobject(&ostream_view<Char, Traits>::identity,
+                 &ostream_view<Char, Traits>::reduce);
+
+// An ostream reducer that writes to a file descriptor.  Every view, the
+// leftmost one included, writes to a chain of buffers, and reducing views
+// splices their chains, so output is copied only into the chain.  The
+// leftmost view writes its whole chain with writev when write_out is called
+// or the view is destroyed.
+template<typename Char, typename Traits>
+class fd_ostream_view : public std::basic_ostream<Char, Traits>
+{
+    typedef std::basic_ostream<Char, Traits>  base;
+
+    chain_buf<Char, Traits> m_buffer;
+    int m_fd;
+
+public:
+    /** Non-leftmost (identity) view constructor. */
+    fd_ostream_view() : base(&m_buffer), m_fd(-1) {}
+
+    /** Leftmost view constructor. The view writes to fd. */
+    explicit fd_ostream_view(int fd) : base(&m_buffer), m_fd(fd) {}
+
+    ~fd_ostream_view() { write_out(); }
+
+    /** Write the output so far to the file descriptor.  Only the leftmost
+     *  view has one; other views keep their output until it is reduced into
+     *  the leftmost view.  Sets badbit if a write fails.
+     */
+    bool write_out() {
+        if (m_fd < 0 || m_buffer.drain(m_fd))
+            return true;
+        base::setstate(std::ios_base::badbit);
+        return false;
+    }
+
+    static void reduce(void *left_v, void *right_v) {
+      fd_ostream_view<Char, Traits> *left =
+        static_cast<fd_ostream_view<Char, Traits> *>(left_v);
+      fd_ostream_view<Char, Traits> *right =
+        static_cast<fd_ostream_view<Char, Traits> *>(right_v);
+      left->m_buffer.splice(right->m_buffer);
+      right->~fd_ostream_view();
+    }
+
+    static void identity(void *view) {
+      new (view) fd_ostream_view<Char, Traits>();
+    }
+};
+
+template<typename Char, typename Traits = std::char_traits<Char>>
+  using fd_ostream_reducer = fd_ostream_view<Char, Traits>
+    _Hyperobject(&fd_ostream_view<Char, Traits>::identity,
+                 &fd_ostream_view<Char, Traits>::reduce);
 
 } // namespace cilk
 
@@ -0,0 +1,99 @@
+#ifndef _VECTOR_REDUCER_H
+#define _VECTOR_REDUCER_H
+
+#ifdef __cplusplus
+
+#include <cstddef>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace cilk {
+
+// A sequence that parallel strands append to, in serial order, kept as a
+// list of vectors.  Each view appends to its last vector, and reducing two
+// views splices their lists in constant time, so no element is copied or
+// moved until take() concatenates the vectors, moving each element at most
+// once.
+template <typename T, typename Alloc = std::allocator<T>> class append_view {
+    typedef std::vector<T, Alloc> chunk;
+
+    std::list<chunk> m_chunks;
+
+    chunk &last() {
+        if (m_chunks.empty())
+            m_chunks.emplace_back();
+        return m_chunks.back();
+    }
+
+  public:
+    void push_back(const T &x) { last().push_back(x); }
+    void push_back(T &&x) { last().push_back(std::move(x)); }
+
+    template <typename... Args> void emplace_back(Args &&...args) {
+        last().emplace_back(std::forward<Args>(args)...);
+    }
+
+    std::size_t size() const {
+        std::size_t n = 0;
+        for (const chunk &c : m_chunks)
+            n += c.size();
+        return n;
+    }
+
+    bool empty() const { return size() == 0; }
+
+    // Call f on each element in order.
+    template <typename F> void for_each(F f) {
+        for (chunk &c : m_chunks)
+            for (T &x : c)
+                f(x);
+    }
+
+    template <typename F> void for_each(F f) const {
+        for (const chunk &c : m_chunks)
+            for (const T &x : c)
+                f(x);
+    }
+
+    // Concatenate the elements into one vector and leave the view empty.
+    // The first vector is moved as a whole, and the elements of the others
+    // are moved onto its end.
+    std::vector<T, Alloc> take() {
+        std::vector<T, Alloc> result;
+        if (m_chunks.empty())
+            return result;
+        std::size_t n = size();
+        result = std::move(m_chunks.front());
+        m_chunks.pop_front();
+        result.reserve(n);
+        for (chunk &c : m_chunks)
+            result.insert(result.end(), std::make_move_iterator(c.begin()),
+                          std::make_move_iterator(c.end()));
+        m_chunks.clear();
+        return result;
+    }
+
+    static void identity(void *view) { new (view) append_view(); }
+
+    static void reduce(void *left_v, void *right_v) {
+        append_view *left = static_cast<append_view *>(left_v);
+        append_view *right = static_cast<append_view *>(right_v);
+        left->m_chunks.splice(left->m_chunks.end(), right->m_chunks);
+        right->~append_view();
+    }
+};
+
+template <typename T, typename Alloc = std::allocator<T>>
+using vector_append_reducer = append_view<T, Alloc>
+    _Hyperobject(&append_view<T, Alloc>::identity,
+                 &append_view<T, Alloc>::reduce);
+
+} // namespace cilk
+
+#endif // #ifdef __cplusplus
+
+#endif // _VECTOR_REDUCER_H
@@ -67,6 +67,7 @@ get_worker_from_stack(const __cilkrts_stack_frame *sf) {
 CHEETAH_INTERNAL
 void *internal_reducer_lookup(__cilkrts_worker *w, void *key, size_t size,
                               void *identity_ptr, void *reduce_ptr);
+// Remove the view of key that internal_reducer_lookup created and free it.
 CHEETAH_INTERNAL
 void internal_reducer_remove(__cilkrts_worker *w, void *key);
 
@@ -56,6 +56,24 @@ int __cilkrts_atexit(void (*callback)(void)) {
     return 0;
 }
 
+// Select the stack-size class of the fibers used by subsequent cilkified
+// regions.  Workers allocate fibers for steals of the selected class, so it
+// cannot change while a region runs.  Returns the previous class, or -1 if
+// the class is invalid, the runtime is not initialized, or a cilkified region
+// is running.
+int __cilkrts_set_stack_size_class(enum __cilkrts_stack_size_class c) {
+    global_state *g = default_cilkrts;
+    if (NULL == g || (unsigned)c >= NUM_STACK_SIZE_CLASSES)
+        return -1;
+    // A region that starts takes the class under the same lock.
+    int old = -1;
+    pthread_mutex_lock(&g->cilkified_lock);
+    if (!atomic_load_explicit(&g->cilkified, memory_order_acquire))
+        old = cilk_fiber_pool_set_stack_class(g, c);
+    pthread_mutex_unlock(&g->cilkified_lock);
+    return old;
+}
+
 // Called after a normal cilk_sync or a cilk_sync performed within the
 // personality function.  Checks if there is an exception that needs to be
 // propagated. This is called from the frame that will handle whatever exception
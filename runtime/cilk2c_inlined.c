@@ -50,16 +50,18 @@ void *__cilkrts_reducer_lookup(void *key, size_t size,
     // If we're outside a cilkified region, then the key is the view.
     if (__cilkrts_need_to_cilkify)
         return key;
-    struct local_hyper_table *table = get_hyper_table();
-    struct bucket *b = find_hyperobject(table, (uintptr_t)key);
-    if (__builtin_expect(!!b, true)) {
-        // Return the existing view.
-        return b->value.view;
+    // Return the view of a recently looked-up key from the lookup cache.
+    // Leave anything else to the runtime, to keep this inlined code small.
+    struct local_hyper_table *table =
+        get_local_hyper_table_or_null(__cilkrts_get_tls_worker());
+    if (__builtin_expect(!!table, true)) {
+        void *view = lookup_cached_view(table, (uintptr_t)key);
+        if (__builtin_expect(!!view, true))
+            return view;
     }
 
-    return __cilkrts_insert_new_view(table, (uintptr_t)key, size,
-                                     (__cilk_identity_fn)identity_ptr,
-                                     (__cilk_reduce_fn)reduce_ptr);
+    return __cilkrts_reducer_lookup_uncached(key, size, identity_ptr,
+                                             reduce_ptr);
 }
 
 // Begin a Cilkified region.  The routine runs on a Cilkifying thread to
@@ -209,6 +211,11 @@ __cilk_sync_nothrow(__cilkrts_stack_frame *sf) {
 
 __attribute__((always_inline)) void
 __cilkrts_leave_frame(__cilkrts_stack_frame *sf) {
+    // Before the Cilkified region ends, run the reductions deferred to Cilk
+    // code while sf is still the current frame, so that they can spawn.
+    if (sf->flags & CILK_FRAME_LAST)
+        __cilkrts_run_deferred_reductions();
+
     // TODO: Move load of worker pointer out of fast path.
     __cilkrts_worker *w = get_worker_from_stack(sf);
     cilkrts_alert(CFRAME, "__cilkrts_leave_frame %p", (void *)sf);
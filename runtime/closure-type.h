@@ -1,6 +1,8 @@
 #ifndef _CLOSURE_TYPE_H
 #define _CLOSURE_TYPE_H
 
+#include <stddef.h>
+
 #include "cilk-internal.h"
 #include "fiber.h"
 #include "local-hypertable.h"
@@ -23,23 +25,27 @@ enum ClosureStatus {
  * the list of children is not distributed among
  * the children themselves, in order to avoid extra protocols
  * and locking.
+ *
+ * The fields touched when stealing, returning and syncing, including the
+ * lock, share the first cache line, so a Closure is two cache lines.  The
+ * second holds state used only around suspended syncs, commutative reducers
+ * and extensions.
  */
 struct Closure {
-    __cilkrts_stack_frame *frame; /* rest of the closure */
-
-    struct cilk_fiber *fiber;
-    struct cilk_fiber *fiber_child;
-
-    struct cilk_fiber *ext_fiber;
-    struct cilk_fiber *ext_fiber_child;
-
-    worker_id owner_ready_deque; /* debug only */
+    _Atomic(worker_id) mutex_owner;
 
     enum ClosureStatus status : 8; /* doubles as magic number */
     bool has_cilk_callee;
     bool exception_pending;
-    unsigned int join_counter; /* number of outstanding spawned children */
-    char *orig_rsp; /* the rsp one should use when sync successfully */
+    /* number of outstanding spawned children; see Closure_return */
+    _Atomic(unsigned int) join_counter;
+
+    worker_id owner_ready_deque; /* debug only */
+
+    __cilkrts_stack_frame *frame; /* rest of the closure */
+
+    struct cilk_fiber *fiber;
+    struct cilk_fiber *fiber_child;
 
     Closure *callee;
 
@@ -75,8 +81,22 @@ struct Closure {
     hyper_table *child_ht;
     hyper_table *user_ht;
 
-    _Atomic(worker_id) mutex_owner __attribute__((aligned(CILK_CACHE_LINE)));
+    /* Cold fields */
+
+    char *orig_rsp; /* the rsp one should use when sync successfully */
+    worker_id sync_worker; /* worker whose sync suspended the closure */
+
+    /* views of commutative reducers that returning children left, published
+       by compare-and-swap without the lock */
+    _Atomic(hyper_table *) comm_ht;
+
+    struct cilk_fiber *ext_fiber;
+    struct cilk_fiber *ext_fiber_child;
 
 } __attribute__((aligned(CILK_CACHE_LINE)));
 
+_Static_assert(CILK_CACHE_LINE < 128 ||
+                   offsetof(struct Closure, orig_rsp) <= CILK_CACHE_LINE,
+               "Hot Closure fields do not fit in one cache line");
+
 #endif
@@ -132,7 +132,8 @@ static inline int Closure_at_top_of_stack(__cilkrts_worker *const w,
 
 static inline int Closure_has_children(Closure *cl) {
 
-    return (cl->has_cilk_callee || cl->join_counter != 0);
+    return (cl->has_cilk_callee ||
+            atomic_load_explicit(&cl->join_counter, memory_order_relaxed) != 0);
 }
 
 static inline void Closure_init(Closure *t, __cilkrts_stack_frame *frame) {
@@ -141,7 +142,7 @@ static inline void Closure_init(Closure *t, __cilkrts_stack_frame *frame) {
     t->status = CLOSURE_PRE_INVALID;
     t->has_cilk_callee = false;
     t->exception_pending = false;
-    t->join_counter = 0;
+    atomic_store_explicit(&t->join_counter, 0, memory_order_relaxed);
 
     t->frame = frame;
     t->fiber = NULL;
@@ -150,6 +151,7 @@ static inline void Closure_init(Closure *t, __cilkrts_stack_frame *frame) {
     t->ext_fiber_child = NULL;
 
     t->orig_rsp = NULL;
+    t->sync_worker = NO_WORKER;
 
     t->callee = NULL;
 
@@ -166,6 +168,7 @@ static inline void Closure_init(Closure *t, __cilkrts_stack_frame *frame) {
     t->user_ht = NULL;
     t->child_ht = NULL;
     t->right_ht = NULL;
+    atomic_store_explicit(&t->comm_ht, NULL, memory_order_relaxed);
 }
 
 static inline Closure *Closure_create(__cilkrts_worker *const w,
@@ -384,6 +387,7 @@ static inline void Closure_clean(Closure *t) {
     CILK_ASSERT_NULL(t->user_ht);
     CILK_ASSERT_NULL(t->child_ht);
     CILK_ASSERT_NULL(t->right_ht);
+    CILK_ASSERT_NULL(t->comm_ht);
 }
 
 /* ANGE: destroy the closure and internally free it (put back to global
@@ -3,9 +3,15 @@
 
 #include "rts-config.h"
 
+#include <stdint.h>
+
 struct __cilkrts_worker;
 struct __cilkrts_stack_frame;
 
+// Owner of a fiber that is not in use or was not allocated from a fiber pool.
+// Such fibers do not count against the fiber caps.
+#define FIBER_NO_OWNER UINT32_MAX
+
 // Structure inserted at the top of a fiber, to implement fiber-local storage.
 // The stack begins just below this structure.  See sysdep_get_stack_start().
 struct cilk_fiber {
@@ -26,8 +32,11 @@ struct cilk_fiber {
     // constant for the life of this structure.
     char *alloc_low;         // lowest byte of mapped region
     char *stack_low;         // lowest byte of stack region
+    unsigned int stack_class; // stack-size class of the fiber pool
+    // Worker that allocated the fiber from its pool, or FIBER_NO_OWNER.
+    uint32_t owner;
 
-    // Three unused words remain 64 bit systems with 64 byte cache lines.
+    // Two unused words remain on 64 bit systems with 64 byte cache lines.
 
 } __attribute__((aligned(CILK_CACHE_LINE)));
 
@@ -1,6 +1,8 @@
 #include <inttypes.h> /* PRIu32 */
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "cilk-internal.h"
 #include "debug.h"
@@ -8,19 +10,27 @@
 #include "fiber.h"
 #include "global.h"
 #include "local.h"
-#include "mutex.h"
 
 // When the pool becomes full (empty), free (allocate) this fraction
 // of the pool back to (from) parent / the OS.
 #define BATCH_FRACTION 2
 
 //=========================================================================
-// Currently the fiber pools are organized into two-levels, like in Hoard
-// --- per-worker private pool plus a global pool.  The per-worker private
-// pool are accessed by the owner worker only and thus do not require
-// synchronization.  The global pool may be accessed concurrently and thus
-// require synchronization.  Thus, the pool->lock is initialized to NULL for
-// per-worker pools and cilk_mutex for the global one.
+// Currently the fiber pools are organized into levels, like in Hoard ---
+// per-worker private pool, an optional per-NUMA-node pool, plus a global
+// pool.  The per-worker private pool are accessed by the owner worker only
+// and thus do not require synchronization.  The node and global pools may be
+// accessed concurrently and are lock free: they store free fibers in
+// fixed-size batches kept on a Treiber stack, so that a batch moves between
+// a per-worker pool and a shared pool with a single compare-and-swap.  A
+// second Treiber stack holds the batch descriptors that are not currently
+// holding any fibers.
+//
+// On a machine with more than one NUMA node, each worker's parent is the
+// pool of its node, whose parent in turn is the global pool.  Node pools
+// allocate new stacks with a preference for node-local memory, and a worker
+// refills from its own node before falling back to the global pool, so that
+// fibers freed on one node tend to be reused on the same node.
 //
 // The per-worker pools are initlaized with some free fibers preallocated
 // already and the global one starts out empty.  A worker typically acquires
@@ -33,6 +43,11 @@
 // the global one to load balance between per-worker pools.
 //=========================================================================
 
+static inline struct cilk_shared_fiber_pool *
+node_fiber_pool(global_state *g, unsigned int node, unsigned int stack_class) {
+    return &g->node_fiber_pools[node * NUM_STACK_SIZE_CLASSES + stack_class];
+}
+
 //=========================================================
 // Private helper functions for maintaining pool stats
 //=========================================================
@@ -43,43 +58,229 @@ static void fiber_pool_stat_init(struct cilk_fiber_pool *pool) {
     pool->stats.max_free = 0;
 }
 
+static void shared_fiber_pool_stat_init(struct cilk_shared_fiber_pool *pool) {
+    atomic_store_explicit(&pool->stats.size, 0, memory_order_relaxed);
+    atomic_store_explicit(&pool->stats.in_use, 0, memory_order_relaxed);
+    atomic_store_explicit(&pool->stats.max_in_use, 0, memory_order_relaxed);
+    atomic_store_explicit(&pool->stats.max_free, 0, memory_order_relaxed);
+}
+
+/* Record that n fibers moved into (n > 0) or out of (n < 0) the global pool.
+   The high watermarks are maintained on a best-effort basis. */
+static void shared_fiber_pool_stat_update(struct cilk_shared_fiber_pool *pool,
+                                          int n) {
+    int size = n + atomic_fetch_add_explicit(&pool->stats.size, n,
+                                             memory_order_relaxed);
+    int in_use = -n + atomic_fetch_sub_explicit(&pool->stats.in_use, n,
+                                                memory_order_relaxed);
+    if (in_use > atomic_load_explicit(&pool->stats.max_in_use,
+                                      memory_order_relaxed))
+        atomic_store_explicit(&pool->stats.max_in_use, in_use,
+                              memory_order_relaxed);
+    if (size > 0 && (unsigned)size > atomic_load_explicit(
+                                          &pool->stats.max_free,
+                                          memory_order_relaxed))
+        atomic_store_explicit(&pool->stats.max_free, (unsigned)size,
+                              memory_order_relaxed);
+}
+
 #define POOL_FMT "size %3u, %4d used %4d max used %4u max free"
 
+struct fiber_pool_stat_print_args {
+    FILE *fp;
+    unsigned int stack_class;
+};
+
 static void fiber_pool_stat_print_worker(__cilkrts_worker *w, void *data) {
-    FILE *fp = (FILE *)data;
-    fprintf(fp, "[W%02" PRIu32 "] " POOL_FMT "\n", w->self,
-            w->l->fiber_pool.size, w->l->fiber_pool.stats.in_use,
-            w->l->fiber_pool.stats.max_in_use, w->l->fiber_pool.stats.max_free);
+    struct fiber_pool_stat_print_args *args =
+        (struct fiber_pool_stat_print_args *)data;
+    struct cilk_fiber_pool *pool = &w->l->fiber_pool[args->stack_class];
+    fprintf(args->fp, "[W%02" PRIu32 "] " POOL_FMT "\n", w->self, pool->size,
+            pool->stats.in_use, pool->stats.max_in_use, pool->stats.max_free);
+}
+
+static void shared_fiber_pool_stat_print(const char *name,
+                                         struct cilk_shared_fiber_pool *pool) {
+    fprintf(stderr, "[%s] " POOL_FMT "\n", name,
+            (unsigned)atomic_load(&pool->stats.size),
+            atomic_load(&pool->stats.in_use),
+            atomic_load(&pool->stats.max_in_use),
+            atomic_load(&pool->stats.max_free));
 }
 
 static void fiber_pool_stat_print(struct global_state *g) {
-    fprintf(stderr, "\nFIBER POOL STATS\n[G  ] " POOL_FMT "\n",
-            g->fiber_pool.size, g->fiber_pool.stats.in_use,
-            g->fiber_pool.stats.max_in_use, g->fiber_pool.stats.max_free);
-    for_each_worker(g, &fiber_pool_stat_print_worker, stderr);
+    fprintf(stderr, "\nFIBER POOL STATS\n");
+    for (unsigned int c = 0; c < NUM_STACK_SIZE_CLASSES; ++c) {
+        // Skip stack-size classes that were never selected.
+        if (!atomic_load_explicit(&g->stack_class_used[c],
+                                  memory_order_relaxed))
+            continue;
+        fprintf(stderr, "class %u, stack size %zu\n", c,
+                g->stack_class_size[c]);
+        shared_fiber_pool_stat_print("G  ", &g->fiber_pool[c]);
+        if (g->node_fiber_pools) {
+            for (unsigned int i = 0; i < g->numa.nnodes; ++i) {
+                char name[sizeof("N4294967295")];
+                snprintf(name, sizeof(name), "N%02u", i);
+                shared_fiber_pool_stat_print(name, node_fiber_pool(g, i, c));
+            }
+        }
+        struct fiber_pool_stat_print_args args = {stderr, c};
+        for_each_worker(g, &fiber_pool_stat_print_worker, &args);
+    }
     fprintf(stderr, "\n");
 }
 
+//=========================================================
+// Private helper functions for the lock-free batch stacks
+//=========================================================
+
+#define BATCH_INDEX_MASK ((uint64_t)0xffffffff)
+#define BATCH_TAG_ONE ((uint64_t)1 << 32)
+
+static void batch_stack_push(struct cilk_shared_fiber_pool *pool,
+                             fiber_batch_stack *stack,
+                             struct cilk_fiber_batch *batch) {
+    uint32_t index = (uint32_t)(batch - pool->batches) + 1;
+    uint64_t old = atomic_load_explicit(stack, memory_order_relaxed);
+    uint64_t new;
+    do {
+        atomic_store_explicit(&batch->next, (uint32_t)(old & BATCH_INDEX_MASK),
+                              memory_order_relaxed);
+        new = ((old & ~BATCH_INDEX_MASK) + BATCH_TAG_ONE) | index;
+    } while (!atomic_compare_exchange_weak_explicit(
+        stack, &old, new, memory_order_release, memory_order_relaxed));
+}
+
+static struct cilk_fiber_batch *
+batch_stack_pop(struct cilk_shared_fiber_pool *pool,
+                fiber_batch_stack *stack) {
+    uint64_t old = atomic_load_explicit(stack, memory_order_acquire);
+    uint64_t new;
+    struct cilk_fiber_batch *batch;
+    do {
+        uint32_t index = (uint32_t)(old & BATCH_INDEX_MASK);
+        if (index == 0)
+            return NULL;
+        batch = &pool->batches[index - 1];
+        // The batch may be popped and pushed again by another worker before
+        // the CAS below; the tag makes the CAS fail in that case.
+        uint32_t next =
+            atomic_load_explicit(&batch->next, memory_order_relaxed);
+        new = ((old & ~BATCH_INDEX_MASK) + BATCH_TAG_ONE) | next;
+    } while (!atomic_compare_exchange_weak_explicit(
+        stack, &old, new, memory_order_acquire, memory_order_acquire));
+    return batch;
+}
+
+/**
+ * Take up to max fibers out of the shared pool, or failing that, out of the
+ * nearest ancestor that has any.  Returns the number of fibers stored into
+ * fibers.
+ */
+static unsigned int
+shared_fiber_pool_get(struct cilk_shared_fiber_pool *pool,
+                      struct cilk_fiber **fibers, unsigned int max) {
+    for (; pool; pool = pool->parent) {
+        struct cilk_fiber_batch *batch = batch_stack_pop(pool, &pool->full);
+        if (!batch)
+            continue;
+        unsigned int n = batch->size <= max ? batch->size : max;
+        batch->size -= n;
+        memcpy(fibers, &batch->fibers[batch->size], n * sizeof(*fibers));
+        shared_fiber_pool_stat_update(pool, -(int)n);
+        // Give back any excess as a batch of its own.
+        batch_stack_push(pool, batch->size ? &pool->full : &pool->empty,
+                         batch);
+        return n;
+    }
+    return 0;
+}
+
+/**
+ * Put up to the last count fibers in fibers into the shared pool, or failing
+ * that, into the nearest ancestor with room.  Returns the number of fibers
+ * put.
+ */
+static unsigned int
+shared_fiber_pool_put(struct cilk_shared_fiber_pool *pool,
+                      struct cilk_fiber **fibers, unsigned int count) {
+    for (; pool; pool = pool->parent) {
+        struct cilk_fiber_batch *batch = batch_stack_pop(pool, &pool->empty);
+        if (!batch)
+            continue;
+        unsigned int n = count <= pool->batch_size ? count : pool->batch_size;
+        memcpy(batch->fibers, &fibers[count - n], n * sizeof(*fibers));
+        batch->size = n;
+        shared_fiber_pool_stat_update(pool, (int)n);
+        batch_stack_push(pool, &pool->full, batch);
+        return n;
+    }
+    return 0;
+}
+
 //=========================================================
 // Private helper functions
 //=========================================================
 
-// forward decl
-static void fiber_pool_allocate_batch(worker_id self,
-                                      struct cilk_fiber_pool *pool,
-                                      unsigned int num_to_allocate);
-static void fiber_pool_free_batch(worker_id self,
-                                  struct cilk_fiber_pool *pool,
-                                  unsigned int num_to_free);
+/* Helper function for initializing a shared fiber pool */
+static void shared_fiber_pool_init(struct cilk_shared_fiber_pool *pool,
+                                   size_t stacksize, unsigned int batch_size,
+                                   unsigned int num_batches,
+                                   struct cilk_shared_fiber_pool *parent,
+                                   int node, int mem_node) {
+    pool->stack_size = stacksize;
+    pool->parent = parent;
+    pool->node = node;
+    pool->mem_node = mem_node;
+    pool->batch_size = batch_size;
+    pool->num_batches = num_batches;
+    pool->batches = calloc(num_batches, sizeof(*pool->batches));
+    pool->fibers = calloc((size_t)num_batches * batch_size,
+                          sizeof(*pool->fibers));
+    CILK_ASSERT(NULL != pool->batches && NULL != pool->fibers);
+    atomic_init(&pool->full, 0);
+    atomic_init(&pool->empty, 0);
+    for (unsigned int i = 0; i < num_batches; i++) {
+        struct cilk_fiber_batch *batch = &pool->batches[i];
+        batch->size = 0;
+        batch->fibers = &pool->fibers[(size_t)i * batch_size];
+        batch_stack_push(pool, &pool->empty, batch);
+    }
+    shared_fiber_pool_stat_init(pool);
+}
+
+/* Helper function for returning the fibers in a shared pool to the OS.
+   Workers must have stopped, so nothing else touches the stacks. */
+static void shared_fiber_pool_terminate(global_state *g,
+                                        struct cilk_shared_fiber_pool *pool) {
+    struct cilk_fiber_batch *batch;
+    while ((batch = batch_stack_pop(pool, &pool->full))) {
+        while (batch->size > 0) {
+            struct cilk_fiber *fiber = batch->fibers[--batch->size];
+            cilk_fiber_deallocate_global(g, fiber);
+        }
+        batch_stack_push(pool, &pool->empty, batch);
+    }
+}
+
+/* Helper function for destroying a shared fiber pool */
+static void shared_fiber_pool_destroy(struct cilk_shared_fiber_pool *pool) {
+    // worker 0 should have freed everything
+    CILK_ASSERT(0 == (atomic_load(&pool->full) & BATCH_INDEX_MASK));
+    free(pool->batches);
+    free(pool->fibers);
+    pool->batches = NULL;
+    pool->fibers = NULL;
+    pool->parent = NULL;
+}
 
 /* Helper function for initializing fiber pool */
 static void fiber_pool_init(struct cilk_fiber_pool *pool, size_t stacksize,
-                            unsigned int bufsize,
-                            struct cilk_fiber_pool *parent, int is_shared) {
-    cilk_mutex_init(&pool->lock);
-    pool->mutex_owner = NO_WORKER;
-    pool->shared = is_shared;
+                            unsigned int stack_class, unsigned int bufsize,
+                            struct cilk_shared_fiber_pool *parent) {
     pool->stack_size = stacksize;
+    pool->stack_class = stack_class;
     pool->parent = parent;
     pool->capacity = bufsize;
     pool->size = 0;
@@ -89,7 +290,6 @@ static void fiber_pool_init(struct cilk_fiber_pool *pool, size_t stacksize,
 /* Helper function for destroying fiber pool */
 static void fiber_pool_destroy(struct cilk_fiber_pool *pool) {
     CILK_ASSERT(pool->size == 0);
-    cilk_mutex_destroy(&pool->lock);
     // pool->fibers might be NULL if the fiber pool was never actually
     // initialized, e.g., because no Cilk code was run.
     if (pool->fibers == NULL)
@@ -99,47 +299,12 @@ static void fiber_pool_destroy(struct cilk_fiber_pool *pool) {
     pool->fibers = NULL;
 }
 
-static inline void fiber_pool_assert_ownership(worker_id self,
-                                               struct cilk_fiber_pool *pool) {
-    if (pool->shared)
-        CILK_ASSERT(pool->mutex_owner == self);
-}
-
-static inline void fiber_pool_assert_alienation(worker_id self,
-                                                struct cilk_fiber_pool *pool) {
-    if (pool->shared)
-        CILK_ASSERT(pool->mutex_owner != self);
-}
-
-static inline void fiber_pool_lock(worker_id self,
-                                   struct cilk_fiber_pool *pool) {
-    if (pool->shared) {
-        fiber_pool_assert_alienation(self, pool);
-        cilk_mutex_lock(&pool->lock);
-        pool->mutex_owner = self;
-    }
-}
-
-static inline void fiber_pool_unlock(worker_id self,
-                                     struct cilk_fiber_pool *pool) {
-    if (pool->shared) {
-        fiber_pool_assert_ownership(self, pool);
-        pool->mutex_owner = NO_WORKER;
-        cilk_mutex_unlock(&pool->lock);
-    }
-}
-
 /**
  * Increase the buffer size for the free fibers.  If the current size is
- * already larger than the new size, do nothing.  Assume lock acquired upon
- * entry.
+ * already larger than the new size, do nothing.
  */
-static void fiber_pool_increase_capacity(worker_id self,
-                                         struct cilk_fiber_pool *pool,
+static void fiber_pool_increase_capacity(struct cilk_fiber_pool *pool,
                                          unsigned int new_size) {
-
-    fiber_pool_assert_ownership(self, pool);
-
     if (pool->capacity < new_size) {
         struct cilk_fiber **larger =
             realloc(pool->fibers, new_size * sizeof(*pool->fibers));
@@ -150,64 +315,34 @@ static void fiber_pool_increase_capacity(worker_id self,
     }
 }
 
-/**
- * Decrease the buffer size for the free fibers.  If the current size is
- * already smaller than the new size, do nothing.  Assume lock acquired upon
- * entry.
- */
-__attribute__((unused)) // unused for now
-static void
-fiber_pool_decrease_capacity(worker_id self, struct cilk_fiber_pool *pool,
-                             unsigned int new_size) {
-
-    fiber_pool_assert_ownership(self, pool);
-
-    if (pool->size > new_size) {
-        int diff = pool->size - new_size;
-        fiber_pool_free_batch(self, pool, diff);
-        CILK_ASSERT(pool->size == new_size);
-    }
-    if (pool->capacity > new_size) {
-        struct cilk_fiber **smaller = (struct cilk_fiber **)realloc(
-            pool->fibers, new_size * sizeof(struct cilk_fiber *));
-        if (smaller) {
-            pool->fibers = smaller;
-            pool->capacity = new_size;
-        }
-    }
-}
-
 /**
  * Allocate num_to_allocate number of new fibers into the pool.
  * We will first look into the parent pool, and if the parent pool does not
  * have enough, we then get it from the system.
  */
-static void fiber_pool_allocate_batch(worker_id self,
-                                      struct cilk_fiber_pool *pool,
+static void fiber_pool_allocate_batch(struct cilk_fiber_pool *pool,
                                       const unsigned int batch_size) {
-
-    fiber_pool_assert_ownership(self, pool);
-    fiber_pool_increase_capacity(self, pool, batch_size + pool->size);
+    fiber_pool_increase_capacity(pool, batch_size + pool->size);
 
     unsigned int from_parent = 0;
-    if (pool->parent) {
-        struct cilk_fiber_pool *parent = pool->parent;
-        fiber_pool_lock(self, parent);
-        from_parent = parent->size <= batch_size ? parent->size : batch_size;
-        for (unsigned int i = 0; i < from_parent; i++) {
-            pool->fibers[pool->size++] = parent->fibers[--parent->size];
-        }
-        // update parent pool stats before releasing the lock on it
-        parent->stats.in_use += from_parent;
-        if (parent->stats.in_use > parent->stats.max_in_use) {
-            parent->stats.max_in_use = parent->stats.in_use;
-        }
-        fiber_pool_unlock(self, parent);
+    while (from_parent < batch_size) {
+        unsigned int n =
+            shared_fiber_pool_get(pool->parent, &pool->fibers[pool->size],
+                                  batch_size - from_parent);
+        if (n == 0)
+            break;
+        pool->size += n;
+        from_parent += n;
     }
     if (batch_size > from_parent) { // if we need more still
+        int mem_node = pool->parent ? pool->parent->mem_node : -1;
         for (unsigned int i = from_parent; i < batch_size; i++) {
-            pool->fibers[pool->size++] =
-                cilk_fiber_allocate(pool->stack_size);
+            struct cilk_fiber *fiber =
+                cilk_fiber_allocate_on_node(pool->stack_size, mem_node);
+            if (fiber == NULL)
+                break; // out of memory; make do with what we have
+            fiber->stack_class = pool->stack_class;
+            pool->fibers[pool->size++] = fiber;
         }
     }
     if (pool->size > pool->stats.max_free) {
@@ -219,29 +354,20 @@ static void fiber_pool_allocate_batch(worker_id self,
  * Free num_to_free fibers from this pool back to either the parent
  * or the system.
  */
-static void fiber_pool_free_batch(worker_id self,
-                                  struct cilk_fiber_pool *pool,
+static void fiber_pool_free_batch(struct cilk_fiber_pool *pool,
                                   const unsigned int batch_size) {
-    fiber_pool_assert_ownership(self, pool);
     CILK_ASSERT(batch_size <= pool->size);
 
     unsigned int to_parent = 0;
-    if (pool->parent) { // first try to free into the parent
-        struct cilk_fiber_pool *parent = pool->parent;
-        fiber_pool_lock(self, parent);
-        to_parent = (batch_size <= (parent->capacity - parent->size))
-                        ? batch_size
-                        : (parent->capacity - parent->size);
-        // free what we can within the capacity of the parent pool
-        for (unsigned int i = 0; i < to_parent; i++) {
-            parent->fibers[parent->size++] = pool->fibers[--pool->size];
-        }
-        CILK_ASSERT(parent->size <= parent->capacity);
-        parent->stats.in_use -= to_parent;
-        if (parent->size > parent->stats.max_free) {
-            parent->stats.max_free = parent->size;
-        }
-        fiber_pool_unlock(self, parent);
+    // first try to free into the parent, within its capacity
+    while (to_parent < batch_size) {
+        unsigned int n = shared_fiber_pool_put(
+            pool->parent, &pool->fibers[pool->size - (batch_size - to_parent)],
+            batch_size - to_parent);
+        if (n == 0)
+            break;
+        pool->size -= n;
+        to_parent += n;
     }
     if ((batch_size - to_parent) > 0) { // still need to free more
         for (unsigned int i = to_parent; i < batch_size; i++) {
@@ -258,11 +384,42 @@ static void fiber_pool_free_batch(worker_id self,
 /* Global fiber pool initialization: */
 void cilk_fiber_pool_global_init(global_state *g) {
 
-    unsigned int bufsize = g->options.nproc * g->options.fiber_pool_cap;
-    struct cilk_fiber_pool *pool = &(g->fiber_pool);
-    fiber_pool_init(pool, g->options.stacksize, bufsize, NULL, 1 /*shared*/);
-    CILK_ASSERT(NULL != pool->fibers);
-    fiber_pool_stat_init(pool);
+    unsigned int batch_size = g->options.fiber_pool_cap / BATCH_FRACTION;
+    unsigned int num_batches = g->options.nproc * BATCH_FRACTION;
+    unsigned int nnodes = g->numa.nnodes;
+    CILK_ASSERT(batch_size > 0);
+
+    // make_stack() clamps these to the supported range of stack sizes.
+    g->stack_class_size[STACK_CLASS_DEFAULT] = g->options.stacksize;
+    g->stack_class_size[STACK_CLASS_SMALL] =
+        g->options.stacksize >> STACK_SIZE_CLASS_SHIFT;
+    g->stack_class_size[STACK_CLASS_LARGE] =
+        g->options.stacksize << STACK_SIZE_CLASS_SHIFT;
+    atomic_init(&g->stack_class, STACK_CLASS_DEFAULT);
+    atomic_init(&g->fibers_in_use, 0);
+
+    for (unsigned int c = 0; c < NUM_STACK_SIZE_CLASSES; c++) {
+        shared_fiber_pool_init(&g->fiber_pool[c], g->stack_class_size[c],
+                               batch_size, num_batches, NULL, -1, -1);
+        atomic_init(&g->stack_class_used[c], c == STACK_CLASS_DEFAULT);
+    }
+    g->node_fiber_pools = NULL;
+    if (nnodes > 1) {
+        // Each node pool can hold as much as the workers of an evenly
+        // populated node may free into it.
+        g->node_fiber_pools = calloc(nnodes * NUM_STACK_SIZE_CLASSES,
+                                     sizeof(*g->node_fiber_pools));
+        CILK_ASSERT(NULL != g->node_fiber_pools);
+        for (unsigned int i = 0; i < nnodes; i++) {
+            for (unsigned int c = 0; c < NUM_STACK_SIZE_CLASSES; c++) {
+                shared_fiber_pool_init(node_fiber_pool(g, i, c),
+                                       g->stack_class_size[c], batch_size,
+                                       (num_batches + nnodes - 1) / nnodes,
+                                       &g->fiber_pool[c], i,
+                                       g->numa.mock ? -1 : (int)i);
+            }
+        }
+    }
     /* let's not preallocate for global fiber pool for now */
 }
 
@@ -270,20 +427,28 @@ void cilk_fiber_pool_global_init(global_state *g) {
  * stats and print them out (if FIBER_STATS is set)
  */
 void cilk_fiber_pool_global_terminate(global_state *g) {
-    struct cilk_fiber_pool *pool = &g->fiber_pool;
-    cilk_mutex_lock(&pool->lock); /* probably not needed */
-    while (pool->size > 0) {
-        struct cilk_fiber *fiber = pool->fibers[--pool->size];
-        cilk_fiber_deallocate_global(g, fiber);
+    for (unsigned int c = 0; c < NUM_STACK_SIZE_CLASSES; c++) {
+        if (g->node_fiber_pools) {
+            for (unsigned int i = 0; i < g->numa.nnodes; i++)
+                shared_fiber_pool_terminate(g, node_fiber_pool(g, i, c));
+        }
+        shared_fiber_pool_terminate(g, &g->fiber_pool[c]);
     }
-    cilk_mutex_unlock(&pool->lock);
     if (ALERT_ENABLED(FIBER_SUMMARY))
         fiber_pool_stat_print(g);
 }
 
 /* Global fiber pool clean up. */
 void cilk_fiber_pool_global_destroy(global_state *g) {
-    fiber_pool_destroy(&g->fiber_pool); // worker 0 should have freed everything
+    for (unsigned int c = 0; c < NUM_STACK_SIZE_CLASSES; c++) {
+        if (g->node_fiber_pools) {
+            for (unsigned int i = 0; i < g->numa.nnodes; i++)
+                shared_fiber_pool_destroy(node_fiber_pool(g, i, c));
+        }
+        shared_fiber_pool_destroy(&g->fiber_pool[c]);
+    }
+    free(g->node_fiber_pools);
+    g->node_fiber_pools = NULL;
 }
 
 /**
@@ -295,58 +460,107 @@ void cilk_fiber_pool_global_destroy(global_state *g) {
  * cilk_fiber_pool_per_worker_destroy() to succeed.
  */
 void cilk_fiber_pool_per_worker_zero_init(__cilkrts_worker *w) {
-    struct cilk_fiber_pool *pool = &(w->l->fiber_pool);
-    pool->size = 0;
-    pool->fibers = NULL;
+    atomic_init(&w->l->fibers_in_use, 0);
+    for (unsigned int c = 0; c < NUM_STACK_SIZE_CLASSES; c++) {
+        struct cilk_fiber_pool *pool = &(w->l->fiber_pool[c]);
+        pool->size = 0;
+        pool->fibers = NULL;
+    }
 }
 
 /**
  * Per-worker fiber pool initialization: should be called per worker so
  * so that fiber comes from the core on which the worker is running on.
+ * Only the pool for the default stack-size class is preallocated; the
+ * others fill up on demand.
  */
 void cilk_fiber_pool_per_worker_init(__cilkrts_worker *w) {
 
     global_state *g = w->g;
     unsigned int bufsize = g->options.fiber_pool_cap;
-    struct cilk_fiber_pool *pool = &(w->l->fiber_pool);
-    fiber_pool_init(pool, g->options.stacksize, bufsize, &(g->fiber_pool),
-                    0 /* private */);
-    CILK_ASSERT(NULL != pool->fibers);
-    CILK_ASSERT(g->fiber_pool.stack_size == pool->stack_size);
-
-    fiber_pool_stat_init(pool);
-    fiber_pool_allocate_batch(w->self, pool, bufsize / BATCH_FRACTION);
+    unsigned int node = 0;
+    if (g->node_fiber_pools)
+        node = cilk_numa_worker_node(g, w->self);
+    for (unsigned int c = 0; c < NUM_STACK_SIZE_CLASSES; c++) {
+        struct cilk_fiber_pool *pool = &(w->l->fiber_pool[c]);
+        struct cilk_shared_fiber_pool *parent = &(g->fiber_pool[c]);
+        if (g->node_fiber_pools)
+            parent = node_fiber_pool(g, node, c);
+        fiber_pool_init(pool, g->stack_class_size[c], c, bufsize, parent);
+        CILK_ASSERT(NULL != pool->fibers);
+        CILK_ASSERT(g->fiber_pool[c].stack_size == pool->stack_size);
+        fiber_pool_stat_init(pool);
+    }
+
+    fiber_pool_allocate_batch(&(w->l->fiber_pool[STACK_CLASS_DEFAULT]),
+                              bufsize / BATCH_FRACTION);
 }
 
 /* This does not yet destroy the fiber pool; merely collects
  * stats and print them out (if FIBER_STATS is set)
  */
 void cilk_fiber_pool_per_worker_terminate(__cilkrts_worker *w) {
-    struct cilk_fiber_pool *pool = &(w->l->fiber_pool);
-    while (pool->size > 0) {
-        unsigned index = --pool->size;
-        struct cilk_fiber *fiber = pool->fibers[index];
-        pool->fibers[index] = NULL;
-        cilk_fiber_deallocate(fiber);
+    for (unsigned int c = 0; c < NUM_STACK_SIZE_CLASSES; c++) {
+        struct cilk_fiber_pool *pool = &(w->l->fiber_pool[c]);
+        while (pool->size > 0) {
+            unsigned index = --pool->size;
+            struct cilk_fiber *fiber = pool->fibers[index];
+            pool->fibers[index] = NULL;
+            cilk_fiber_deallocate(fiber);
+        }
     }
 }
 
 /* Per-worker fiber pool clean up. */
 void cilk_fiber_pool_per_worker_destroy(__cilkrts_worker *w) {
+    for (unsigned int c = 0; c < NUM_STACK_SIZE_CLASSES; c++) {
+        struct cilk_fiber_pool *pool = &(w->l->fiber_pool[c]);
+        fiber_pool_destroy(pool);
+    }
+}
 
-    struct cilk_fiber_pool *pool = &(w->l->fiber_pool);
-    fiber_pool_destroy(pool);
+/* Make the node pool of the node w runs on now the parent of pool.  Unless
+   workers are pinned, the OS may have moved w since the pool was set up, so
+   this is redone whenever the pool needs refilling. */
+static void fiber_pool_follow_worker(__cilkrts_worker *w,
+                                     struct cilk_fiber_pool *pool) {
+    global_state *g = w->g;
+    if (g->node_fiber_pools)
+        pool->parent = node_fiber_pool(g, cilk_numa_worker_node(g, w->self),
+                                       pool->stack_class);
 }
 
 /**
- * Allocate a fiber from this pool; if this pool is empty,
- * allocate a batch of fibers from the parent pool (or system).
+ * Allocate a fiber of the current stack-size class from this pool; if this
+ * pool is empty, allocate a batch of fibers from the parent pool (or system).
  */
 struct cilk_fiber *cilk_fiber_allocate_from_pool(__cilkrts_worker *w) {
-    struct cilk_fiber_pool *pool = &(w->l->fiber_pool);
+    global_state *g = w->g;
+    unsigned int stack_class =
+        atomic_load_explicit(&g->stack_class, memory_order_relaxed);
+    struct cilk_fiber_pool *pool = &(w->l->fiber_pool[stack_class]);
     if (pool->size == 0) {
-        fiber_pool_allocate_batch(w->self, pool,
-                                  pool->capacity / BATCH_FRACTION);
+        fiber_pool_follow_worker(w, pool);
+        fiber_pool_allocate_batch(pool, pool->capacity / BATCH_FRACTION);
+    }
+    if (pool->size == 0) {
+        // Out of memory.  The fibers reserved by cilk_fiber_pool_reserve()
+        // may be of a class that was selected since; settle for those.
+        for (unsigned int c = 0; c < NUM_STACK_SIZE_CLASSES; c++) {
+            if (w->l->fiber_pool[c].size > 0) {
+                pool = &(w->l->fiber_pool[c]);
+                break;
+            }
+        }
+        if (pool->size == 0)
+            cilkrts_bug("Cilk: out of memory for fiber stacks");
+    }
+    if (g->options.fiber_cap) {
+        atomic_fetch_add_explicit(&w->l->fibers_in_use, 1,
+                                  memory_order_relaxed);
+    }
+    if (g->options.fiber_global_cap) {
+        atomic_fetch_add_explicit(&g->fibers_in_use, 1, memory_order_relaxed);
     }
     struct cilk_fiber *ret = pool->fibers[--pool->size];
     pool->stats.in_use++;
@@ -356,20 +570,43 @@ struct cilk_fiber *cilk_fiber_allocate_from_pool(__cilkrts_worker *w) {
     CILK_ASSERT(ret);
     sanitizer_unpoison_fiber(ret);
     init_fiber_header(ret);
+    ret->owner = w->self;
     return ret;
 }
 
 /**
- * Free fiber_to_return into this pool; if this pool is full,
- * free a batch of fibers back into the parent pool (or system).
+ * Free fiber_to_return into the pool for its stack-size class; if this pool
+ * is full, free a batch of fibers back into the parent pool (or system).
  */
 void cilk_fiber_deallocate_to_pool(__cilkrts_worker *w,
                                    struct cilk_fiber *fiber_to_return) {
-    if (fiber_to_return)
+    unsigned int stack_class = STACK_CLASS_DEFAULT;
+    if (fiber_to_return) {
         sanitizer_poison_fiber(fiber_to_return);
-    struct cilk_fiber_pool *pool = &(w->l->fiber_pool);
+        stack_class = fiber_to_return->stack_class;
+        CILK_ASSERT(stack_class < NUM_STACK_SIZE_CLASSES);
+    }
+    struct cilk_fiber_pool *pool = &(w->l->fiber_pool[stack_class]);
+    if (fiber_to_return) {
+        global_state *g = w->g;
+        // Charge the fiber back to the worker that allocated it, which
+        // might not be this one.  Fibers allocated outside of the pools,
+        // such as those of the root closure, were never counted.
+        if (fiber_to_return->owner != FIBER_NO_OWNER) {
+            if (g->options.fiber_cap) {
+                local_state *owner = g->workers[fiber_to_return->owner]->l;
+                atomic_fetch_sub_explicit(&owner->fibers_in_use, 1,
+                                          memory_order_relaxed);
+            }
+            if (g->options.fiber_global_cap) {
+                atomic_fetch_sub_explicit(&g->fibers_in_use, 1,
+                                          memory_order_relaxed);
+            }
+        }
+        fiber_to_return->owner = FIBER_NO_OWNER;
+    }
     if (pool->size == pool->capacity) {
-        fiber_pool_free_batch(w->self, pool, pool->capacity / BATCH_FRACTION);
+        fiber_pool_free_batch(pool, pool->capacity / BATCH_FRACTION);
         CILK_ASSERT((pool->capacity - pool->size) >=
                            (pool->capacity / BATCH_FRACTION));
     }
@@ -383,3 +620,50 @@ void cilk_fiber_deallocate_to_pool(__cilkrts_worker *w,
         fiber_to_return = NULL;
     }
 }
+
+/**
+ * Select the stack-size class for fibers allocated from now on.  Called only
+ * between cilkified regions, so every fiber a region allocates has the same
+ * class.  Returns the previous class.
+ */
+unsigned int cilk_fiber_pool_set_stack_class(global_state *g,
+                                             unsigned int stack_class) {
+    CILK_ASSERT(stack_class < NUM_STACK_SIZE_CLASSES);
+    atomic_store_explicit(&g->stack_class_used[stack_class], true,
+                          memory_order_relaxed);
+    return atomic_exchange_explicit(&g->stack_class, stack_class,
+                                    memory_order_relaxed);
+}
+
+/**
+ * Check whether n fibers can be allocated from w's pool without exceeding the
+ * per-worker or global cap on fibers in use, refilling the pool if necessary.
+ * Returns false if the caps are reached or the OS is out of memory, in which
+ * case the caller should not start anything that needs a new fiber.
+ *
+ * The global cap is soft: concurrent callers may each see room for their
+ * fibers and overshoot the cap by at most a couple of fibers per worker.
+ */
+bool cilk_fiber_pool_reserve(__cilkrts_worker *w, unsigned int n) {
+    global_state *g = w->g;
+    if (g->options.fiber_cap &&
+        atomic_load_explicit(&w->l->fibers_in_use, memory_order_relaxed) +
+                (int)n >
+            (int)g->options.fiber_cap)
+        return false;
+    if (g->options.fiber_global_cap &&
+        atomic_load_explicit(&g->fibers_in_use, memory_order_relaxed) +
+                (int)n >
+            (int)g->options.fiber_global_cap)
+        return false;
+
+    unsigned int stack_class =
+        atomic_load_explicit(&g->stack_class, memory_order_relaxed);
+    struct cilk_fiber_pool *pool = &(w->l->fiber_pool[stack_class]);
+    if (pool->size < n) {
+        fiber_pool_follow_worker(w, pool);
+        unsigned int batch_size = pool->capacity / BATCH_FRACTION;
+        fiber_pool_allocate_batch(pool, batch_size < n ? n : batch_size);
+    }
+    return pool->size >= n;
+}
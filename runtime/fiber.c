@@ -16,6 +16,7 @@
 #include "fiber.h"
 #include "fiber-header.h"
 #include "init.h"
+#include "numa.h"
 
 #include <string.h> /* memset() */
 
@@ -279,7 +280,7 @@ void sanitizer_poison_fiber(struct cilk_fiber *fiber) {
 // Private helper functions
 //===============================================================
 
-struct cilk_fiber *make_stack(size_t stack_size) {
+static struct cilk_fiber *make_stack(size_t stack_size, int node) {
     const int page_shift = cheetah_page_shift;
     const size_t page_size = 1U << page_shift;
 
@@ -294,11 +295,13 @@ struct cilk_fiber *make_stack(size_t stack_size) {
         0, stack_pages * page_size, PROT_READ | PROT_WRITE,
         MAP_STACK_FLAGS, -1, 0);
     if (MAP_FAILED == alloc_low) {
-        cilkrts_bug(NULL, "Cilk: stack mmap failed");
-        /* Currently unreached.  TODO: Investigate more graceful
-           error handling. */
+        /* The caller decides how to degrade; a thief, for example, declines
+           the steal and leaves the continuation to run serially. */
+        cilkrts_alert(FIBER, "Stack mmap of %zu pages failed", stack_pages);
         return NULL;
     }
+    // Set the memory policy before any page of the stack is touched.
+    cilk_numa_bind(alloc_low, stack_pages * page_size, node);
     char *alloc_high = alloc_low + stack_pages * page_size;
     char *stack_low = alloc_low + page_size;
     char *stack_high = alloc_high - sizeof(struct cilk_fiber);
@@ -308,6 +311,8 @@ struct cilk_fiber *make_stack(size_t stack_size) {
     struct cilk_fiber *f = (struct cilk_fiber *)stack_high;
     f->alloc_low = alloc_low;
     f->stack_low = stack_low;
+    f->stack_class = STACK_CLASS_DEFAULT; // fiber pools override this
+    f->owner = FIBER_NO_OWNER;
     if (DEBUG_ENABLED(MEMORY_SLOW))
         memset(stack_low, 0x11, stack_high - stack_low);
     return f;
@@ -331,7 +336,13 @@ static void free_stack(struct cilk_fiber *f) {
 //===============================================================
 
 struct cilk_fiber *cilk_fiber_allocate(size_t stacksize) {
-    struct cilk_fiber *fiber = make_stack(stacksize);
+    return cilk_fiber_allocate_on_node(stacksize, -1);
+}
+
+struct cilk_fiber *cilk_fiber_allocate_on_node(size_t stacksize, int node) {
+    struct cilk_fiber *fiber = make_stack(stacksize, node);
+    if (fiber == NULL)
+        return NULL;
     init_fiber_header(fiber);
     cilkrts_alert(FIBER, "Allocate fiber %p [%p--%p]", (void *)fiber,
                   (void *)fiber->stack_low,
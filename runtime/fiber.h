@@ -9,12 +9,22 @@
 #include "rts-config.h"
 #include "types.h"
 
+#include <stdatomic.h>
 #include <stdint.h>
 
 //===============================================================
 // Struct defs used by fibers, fiber pools
 //===============================================================
 
+// Stack-size classes of fibers.  These match the values of
+// enum __cilkrts_stack_size_class in <cilk/cilk_api.h>.
+enum stack_size_class {
+    STACK_CLASS_DEFAULT = 0, // g->options.stacksize
+    STACK_CLASS_SMALL = 1,   // default >> STACK_SIZE_CLASS_SHIFT
+    STACK_CLASS_LARGE = 2,   // default << STACK_SIZE_CLASS_SHIFT
+    NUM_STACK_SIZE_CLASSES
+};
+
 // Statistics on active fibers that were allocated from this pool,
 struct fiber_pool_stats {
     int in_use;     // number of fibers allocated - freed from / into the pool
@@ -22,19 +32,62 @@ struct fiber_pool_stats {
     unsigned max_free; // high watermark for number of free fibers in the pool
 };
 
+struct cilk_shared_fiber_pool;
+
+// Per-worker pool of free fibers.  Accessed only by the owner worker.
 struct cilk_fiber_pool {
-    worker_id mutex_owner;
-    int shared;
-    size_t stack_size;              // Size of stacks for fibers in this pool.
-    struct cilk_fiber_pool *parent; // Parent pool.
-                                    // If this pool is empty, get from parent
+    size_t stack_size;                     // Size of stacks for fibers in this pool.
+    unsigned int stack_class;              // Stack-size class of this pool
+    struct cilk_shared_fiber_pool *parent; // Parent pool.
+                                           // If this pool is empty, get from parent
     // Describes inactive fibers stored in the pool.
     struct cilk_fiber **fibers; // Array of max_size fiber pointers
     unsigned int capacity;      // Limit on number of fibers in pool
     unsigned int size;          // Number of fibers currently in the pool
     struct fiber_pool_stats stats;
+};
 
-    cilk_mutex lock __attribute__((aligned(CILK_CACHE_LINE)));
+// A batch of free fibers, moved as a unit between a per-worker pool and the
+// global pool.  Batch descriptors are allocated once, when the global pool is
+// initialized, and are never freed while workers are running, so a thread
+// racing on a stale descriptor only ever reads valid memory.
+struct cilk_fiber_batch {
+    _Atomic uint32_t next; // index + 1 of the next batch on the stack, or 0
+    unsigned int size;     // Number of fibers in this batch
+    struct cilk_fiber **fibers; // Slice of the global fiber array
+};
+
+// Head of a lock-free (Treiber) stack of batches.  The low 32 bits hold the
+// index + 1 of the top batch, or 0 if the stack is empty.  The high 32 bits
+// are a tag incremented on every update to avoid ABA problems.
+typedef _Atomic uint64_t fiber_batch_stack;
+
+// Pool of free fibers shared between workers, used to load balance between
+// per-worker pools.  There is one global pool and, on NUMA machines, one pool
+// per node whose parent is the global pool.  Fibers are stored in batches on
+// the full stack; batch descriptors not currently holding fibers are kept on
+// the empty stack.  The number of batch descriptors bounds the number of
+// fibers the pool can hold.
+struct cilk_shared_fiber_pool {
+    size_t stack_size;           // Size of stacks for fibers in this pool.
+    struct cilk_shared_fiber_pool *parent; // Next pool to try, or NULL
+    int node;                    // NUMA node of this pool, or -1 if global
+    int mem_node;                // Node to allocate stacks on, or -1
+    unsigned int batch_size;     // Maximum number of fibers per batch
+    unsigned int num_batches;    // Number of batch descriptors
+    struct cilk_fiber_batch *batches;
+    struct cilk_fiber **fibers;  // Storage for num_batches * batch_size fibers
+
+    fiber_batch_stack full __attribute__((aligned(CILK_CACHE_LINE)));
+    fiber_batch_stack empty __attribute__((aligned(CILK_CACHE_LINE)));
+
+    // Stats are updated with relaxed atomics only when batches move.
+    struct {
+        _Atomic int size;
+        _Atomic int in_use;
+        _Atomic int max_in_use;
+        _Atomic unsigned max_free;
+    } stats __attribute__((aligned(CILK_CACHE_LINE)));
 };
 
 //===============================================================
@@ -142,10 +195,16 @@ CHEETAH_INTERNAL void cilk_fiber_pool_per_worker_zero_init(__cilkrts_worker *w);
 CHEETAH_INTERNAL void cilk_fiber_pool_per_worker_init(__cilkrts_worker *w);
 CHEETAH_INTERNAL void cilk_fiber_pool_per_worker_terminate(__cilkrts_worker *w);
 CHEETAH_INTERNAL void cilk_fiber_pool_per_worker_destroy(__cilkrts_worker *w);
+CHEETAH_INTERNAL unsigned int
+cilk_fiber_pool_set_stack_class(global_state *g, unsigned int stack_class);
 
-// allocate / deallocate one fiber from / back to OS
+// allocate / deallocate one fiber from / back to OS; allocation returns NULL
+// if the OS is out of memory
 CHEETAH_INTERNAL
 struct cilk_fiber *cilk_fiber_allocate(size_t stacksize);
+// allocate one fiber from OS, preferring memory on the given NUMA node
+CHEETAH_INTERNAL
+struct cilk_fiber *cilk_fiber_allocate_on_node(size_t stacksize, int node);
 CHEETAH_INTERNAL
 void cilk_fiber_deallocate(struct cilk_fiber *fiber);
 CHEETAH_INTERNAL
@@ -156,6 +215,10 @@ struct cilk_fiber *cilk_fiber_allocate_from_pool(__cilkrts_worker *w);
 CHEETAH_INTERNAL
 void cilk_fiber_deallocate_to_pool(__cilkrts_worker *w,
                                    struct cilk_fiber *fiber);
+// check that n fibers can be allocated from the per-worker pool within the
+// fiber caps and the memory available
+CHEETAH_INTERNAL
+bool cilk_fiber_pool_reserve(__cilkrts_worker *w, unsigned int n);
 
 CHEETAH_INTERNAL int in_fiber(struct cilk_fiber *, void *);
 
@@ -93,6 +93,23 @@ static void set_fiber_pool_cap(global_state *g, unsigned int fiber_pool_cap) {
     g->options.fiber_pool_cap = fiber_pool_cap;
 }
 
+static void set_fiber_cap(global_state *g, unsigned int fiber_cap) {
+    // TODO: Verify that g has not yet been initialized.
+    CILK_ASSERT(!g->workers_started);
+    CILK_ASSERT(fiber_cap >= 1);
+    CILK_ASSERT(fiber_cap <= 999999);
+    g->options.fiber_cap = fiber_cap;
+}
+
+static void set_fiber_global_cap(global_state *g,
+                                 unsigned int fiber_global_cap) {
+    // TODO: Verify that g has not yet been initialized.
+    CILK_ASSERT(!g->workers_started);
+    CILK_ASSERT(fiber_global_cap >= 1);
+    CILK_ASSERT(fiber_global_cap <= 99999999);
+    g->options.fiber_global_cap = fiber_global_cap;
+}
+
 // not marked as static as it's called by __cilkrts_internal_set_nworkers
 // used by Cilksan to set nworker to 1 
 void set_nworkers(global_state *g, unsigned int nworkers) {
@@ -113,6 +130,15 @@ static void parse_rts_environment(global_state *g) {
     unsigned int fiber_pool_cap = env_get_int("CILK_FIBER_POOL");
     if (fiber_pool_cap > 0)
         set_fiber_pool_cap(g, fiber_pool_cap);
+    unsigned int fiber_cap = env_get_int("CILK_FIBER_CAP");
+    if (fiber_cap > 0)
+        set_fiber_cap(g, fiber_cap);
+    unsigned int fiber_global_cap = env_get_int("CILK_FIBER_GLOBAL_CAP");
+    if (fiber_global_cap > 0)
+        set_fiber_global_cap(g, fiber_global_cap);
+    unsigned int resume_affinity = env_get_int("CILK_RESUME_AFFINITY");
+    if (resume_affinity > 0)
+        g->options.resume_affinity = resume_affinity;
 
     long proc_override = env_get_int("CILK_NWORKERS");
     if (g->options.nproc == 0) {
@@ -184,6 +210,7 @@ global_state *global_state_init(int argc, char *argv[]) {
     g->index_to_worker = (worker_id *)calloc(active_size, sizeof(worker_id));
     g->worker_to_index = (worker_id *)calloc(active_size, sizeof(worker_id));
     cilk_internal_malloc_global_init(g); // initialize internal malloc first
+    cilk_numa_init(g); // the fiber pools depend on the NUMA topology
     cilk_fiber_pool_global_init(g);
     cilk_global_sched_stats_init(&(g->stats));
 
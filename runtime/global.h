@@ -12,6 +12,7 @@
 #include "internal-malloc-impl.h"
 #include "jmpbuf.h"
 #include "mutex.h"
+#include "numa.h"
 #include "rts-config.h"
 #include "sched_stats.h"
 #include "types.h"
@@ -28,7 +29,10 @@ struct Closure;
         DEFAULT_STACK_SIZE,     /* stack size to use for fiber */  \
         DEFAULT_NPROC,          /* num of workers to create */     \
         DEFAULT_DEQ_DEPTH,      /* num of entries in deque */      \
-        DEFAULT_FIBER_POOL_CAP  /* alloc_batch_size */             \
+        DEFAULT_FIBER_POOL_CAP, /* alloc_batch_size */             \
+        DEFAULT_FIBER_CAP,      /* live fibers per worker */       \
+        DEFAULT_FIBER_GLOBAL_CAP, /* live fibers in total */       \
+        DEFAULT_RESUME_AFFINITY /* resume on the syncing worker */ \
     }
 // clang-format on
 
@@ -37,6 +41,11 @@ struct rts_options {
     unsigned int nproc;          /* can be set via env variable CILK_NWORKERS */
     unsigned int deqdepth;       /* can be set via env variable CILK_DEQDEPTH */
     unsigned int fiber_pool_cap; /* can be set via env variable CILK_FIBER_POOL */
+    unsigned int fiber_cap;      /* can be set via env variable CILK_FIBER_CAP */
+    unsigned int fiber_global_cap; /* can be set via env variable
+                                      CILK_FIBER_GLOBAL_CAP */
+    unsigned int resume_affinity; /* can be set via env variable
+                                     CILK_RESUME_AFFINITY */
 };
 
 struct worker_args {
@@ -56,10 +65,26 @@ struct global_state {
     pthread_t *threads;
     struct Closure *root_closure;
 
-    struct cilk_fiber_pool fiber_pool __attribute__((aligned(CILK_CACHE_LINE)));
+    struct cilk_numa_topology numa;
+    // Fiber pools are keyed by stack-size class.
+    size_t stack_class_size[NUM_STACK_SIZE_CLASSES];
+    atomic_bool stack_class_used[NUM_STACK_SIZE_CLASSES];
+    _Atomic unsigned int stack_class; // class for newly allocated fibers
+    // Fibers in use, maintained only if options.fiber_global_cap is set
+    _Atomic int fibers_in_use __attribute__((aligned(CILK_CACHE_LINE)));
+    // NUMA node pools, NUM_STACK_SIZE_CLASSES per node
+    struct cilk_shared_fiber_pool *node_fiber_pools;
+    struct cilk_shared_fiber_pool fiber_pool[NUM_STACK_SIZE_CLASSES] __attribute__((aligned(CILK_CACHE_LINE)));
     struct global_im_pool im_pool __attribute__((aligned(CILK_CACHE_LINE)));
-    struct cilk_im_desc im_desc __attribute__((aligned(CILK_CACHE_LINE)));
-    cilk_mutex im_lock; // lock for accessing global im_desc
+    struct im_depot im_depot[NUM_BUCKETS];
+    struct im_remote_queue *im_remote; // one per worker
+    long im_num_malloc[IM_NUM_TAGS]; // from terminated workers
+    _Atomic long im_num_user_outside; // cilk_malloc blocks outside of workers
+#if ENABLE_PERCPU_CACHE
+    struct im_cpu_cache *im_cpu_cache; // one per configured CPU
+    unsigned int im_num_cpus;
+#endif
+    cilk_mutex im_lock; // lock for extending the global im pool
 
     // These fields are accessed exclusively by the boss thread.
 
@@ -3,6 +3,8 @@
 
 #include <cilk/cilk_api.h> // __cilk_reduce_fn
 
+struct view_slab;
+
 // Reducer data.
 //
 // NOTE: Since the size and identity_fn are only used when a worker
@@ -10,17 +12,15 @@
 // the reducer_base structure as long as the reducer_lookup function
 // gets them as parameters.
 //
-// TODO: For small reducer views of size less than sizeof(void *),
-// consider storing the view directly within the reducer_base
-// structure.
-// - Problem: A reducer_base structure may move around in the hash
-//   table as other reducers are inserted.  As a result, a pointer to
-//   a view may be invalidated by other hyper_lookup operations.
-// - Problem: Need a way to keep track of whether the view in a
-//   reducer_base is storing a pointer to the view or the view itself.
+// Small views are not stored in the reducer_base itself, since a
+// reducer_base may move around in the hash table as other reducers are
+// inserted, which would invalidate pointers to the view.  Instead, they are
+// carved out of a slab, which slab records.  Large views mapped on zero
+// pages have a slab that marks them as such.
 typedef struct reducer_base {
     void *view;
     __cilk_reduce_fn reduce_fn;
+    struct view_slab *slab; // slab holding view, or NULL or a marker
 } reducer_base;
 
 #endif /* _HYPEROBJECT_BASE */
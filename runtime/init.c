@@ -49,6 +49,7 @@ static local_state *worker_local_init(local_state *l, global_state *g) {
     l->returning = false;
     l->rand_next = 0; /* will be reset in scheduler loop */
     l->wake_val = 0;
+    l->hyper_table_capacity = MIN_CAPACITY;
     cilk_sched_stats_init(&(l->stats));
 
     return l;
@@ -66,6 +67,8 @@ static void deques_init(global_state *g) {
         g->deques[i].top = NULL;
         g->deques[i].bottom = NULL;
         g->deques[i].mutex_owner = NO_WORKER;
+        atomic_store_explicit(&g->deques[i].mailbox, NULL,
+                              memory_order_relaxed);
     }
 }
 
@@ -385,6 +388,8 @@ global_state *__cilkrts_startup(int argc, char *argv[]) {
     __cilkrts_worker *w0 = g->workers[0];
     Closure *t = Closure_create(w0, NULL);
     struct cilk_fiber *fiber = cilk_fiber_allocate(g->options.stacksize);
+    if (fiber == NULL)
+        cilkrts_bug("Cilk: stack mmap failed");
     t->fiber = fiber;
     g->root_closure = t;
 
@@ -493,10 +498,35 @@ void __cilkrts_internal_invoke_cilkified_root(__cilkrts_stack_frame *sf) {
         if (USE_EXTENSION) {
             g->root_closure->ext_fiber =
                 cilk_fiber_allocate(g->options.stacksize);
+            if (g->root_closure->ext_fiber == NULL)
+                cilkrts_bug("Cilk: stack mmap failed");
         }
         boss_initialized = true;
     }
 
+    // Switch the root closure to a fiber of the requested stack-size class,
+    // since the root frame of the region runs on it.  If no such fiber can be
+    // allocated, keep the current one.  The current one may have come from a
+    // fiber pool in the last region, so return it to worker 0's pool, which
+    // the boss thread uses between regions, to keep the fiber caps balanced.
+    //
+    // The class is read under cilkified_lock, which is held until the region
+    // is marked cilkified, so __cilkrts_set_stack_size_class cannot change it
+    // in between.
+    pthread_mutex_lock(&g->cilkified_lock);
+    unsigned int stack_class =
+        atomic_load_explicit(&g->stack_class, memory_order_relaxed);
+    if (g->root_closure->fiber->stack_class != stack_class) {
+        struct cilk_fiber *fiber =
+            cilk_fiber_allocate(g->stack_class_size[stack_class]);
+        if (fiber) {
+            fiber->stack_class = stack_class;
+            cilk_fiber_deallocate_to_pool(g->workers[0],
+                                          g->root_closure->fiber);
+            g->root_closure->fiber = fiber;
+        }
+    }
+
     __cilkrts_need_to_cilkify = false;
 
     // The boss thread will impersonate the last exiting worker until it tries
@@ -546,6 +576,7 @@ void __cilkrts_internal_invoke_cilkified_root(__cilkrts_stack_frame *sf) {
             "ERROR: OpenCilk runtime already executing a Cilk computation.\n");
     }
     set_cilkified(g);
+    pthread_mutex_unlock(&g->cilkified_lock);
 
     // Set g->done = 0, so Cilk workers will continue trying to steal.
     atomic_store_explicit(&g->done, 0, memory_order_release);
@@ -656,6 +687,7 @@ static void global_state_deinit(global_state *g) {
     cilkrts_alert(BOOT, "(global_state_deinit) Clean up global state");
 
     cilk_fiber_pool_global_destroy(g);
+    cilk_numa_destroy(g);
     cilk_internal_malloc_global_destroy(g); // internal malloc last
     cilk_mutex_destroy(&(g->print_lock));
     cilk_mutex_destroy(&(g->index_lock));
@@ -723,11 +755,19 @@ static void wrap_fiber_pool_destroy(__cilkrts_worker *w, void *data) {
 static void workers_deinit(global_state *g) {
     cilkrts_alert(BOOT, "(workers_deinit) Clean up workers");
 
-    long allocations[NUM_BUCKETS] = {0, 0, 0, 0};
+    long allocations[NUM_BUCKETS] = {0};
 
     for_each_worker_rev(g, sum_allocations, allocations);
 
-    if (DEBUG_ENABLED(MEMORY)) {
+    // Count blocks taken from the depot outside of workers, and skip the
+    // check if the program still holds cilk_malloc memory.
+    for (int i = 0; i < NUM_BUCKETS; ++i)
+        allocations[i] += atomic_load_explicit(&g->im_depot[i].outside,
+                                               memory_order_relaxed);
+    long user_blocks =
+        g->im_num_malloc[IM_USER] +
+        atomic_load_explicit(&g->im_num_user_outside, memory_order_relaxed);
+    if (DEBUG_ENABLED(MEMORY) && user_blocks == 0) {
         for (int i = 0; i < NUM_BUCKETS; ++i)
             CILK_ASSERT_INDEX_ZERO(allocations, i, , "%ld");
     }
@@ -785,4 +825,5 @@ CHEETAH_INTERNAL void __cilkrts_shutdown(global_state *g) {
 // Global destructor for shutting down the default cilkrts
 __attribute__((destructor)) void __default_cilkrts_shutdown() {
     __cilkrts_shutdown(default_cilkrts);
+    default_cilkrts = NULL;
 }
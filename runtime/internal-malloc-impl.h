@@ -1,44 +1,133 @@
 #ifndef _INTERAL_MALLOC_IMPL_H
 #define _INTERAL_MALLOC_IMPL_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <stdatomic.h>
+
 #include "debug.h"
 #include "rts-config.h"
 
 #include "internal-malloc.h"
 
-#define NUM_BUCKETS 7
+#define NUM_BUCKETS 15
+
+/* Memory blocks in mem_list are divided into spans of IM_SPAN_SIZE bytes,
+   aligned to IM_SPAN_SIZE.  A span is carved into pieces of one bucket by
+   one worker, which owns the pieces; the header at the start of the span
+   records the owner.  Spans carved for callers outside of workers go
+   straight to the depot and have no owner. */
+#define IM_SPAN_SHIFT 15
+#define IM_SPAN_SIZE ((size_t)1 << IM_SPAN_SHIFT)
+#define IM_NO_OWNER UINT32_MAX
+
+struct im_span {
+    uint32_t owner;  // worker that carved the span, or IM_NO_OWNER
+    uint32_t bucket; // bucket of the pieces, except for a recycled tail
+    struct im_chunk *chunk;
+};
+
+/* A memory block obtained from the system.  The counters let
+   cilk_internal_malloc_trim tell when every piece carved from the block is
+   free. */
+struct im_chunk {
+    char *mem; // NULL once returned to the system
+    size_t size;
+    // Spans handed out in the high 16 bits, spans still being carved by
+    // workers in the low 16 bits
+    _Atomic uint32_t spans;
+    _Atomic size_t carved; // bytes handed out as pieces
+    _Atomic size_t wasted; // bytes that will never be pieces
+    size_t held;           // scratch for cilk_internal_malloc_trim
+    bool releasing;        // scratch for cilk_internal_malloc_trim
+};
 
-/* struct for managing global memory pool; each memory block in mem_list starts
-   out with size INTERNAL_MALLOC_CHUNK.  We will allocate small pieces off the
-   memory block and free the pieces into per-worker im_descriptor free list. */
+/* struct for managing global memory pool; memory blocks in mem_list start
+   out with size INTERNAL_MALLOC_CHUNK and grow with the pool.  We will
+   allocate spans off the memory block and carve the spans into per-worker
+   im_descriptor free lists. */
 struct global_im_pool {
-    char *mem_begin; // beginning of the free memory block that we are using
-    char *mem_end;   // end of the free memory block that we are using
-    char **mem_list; // list of memory blocks obtained from system
+    // Next free span of the memory block that we are using, with the number
+    // of free spans starting there in the low IM_SPAN_SHIFT bits.
+    _Atomic uintptr_t spans;
+    // The remaining fields are protected by im_lock except as noted.
+    struct im_chunk **mem_list; // list of memory blocks obtained from system
     unsigned mem_list_index; // index to the current mem block in use
     unsigned mem_list_size;  // length of the mem_list
     size_t num_global_malloc;
-    size_t allocated; // bytes allocated into the pool
-    size_t wasted;    // bytes at the end of a chunk that could not be used
+    size_t allocated; // bytes allocated into the pool and not released
+    size_t released;  // bytes returned to the system
+    // Atomic, updated without the lock
+    _Atomic size_t carved; // bytes handed out as blocks
+    _Atomic size_t wasted; // span headers and tails and alignment padding
 };
 
+/* Pieces freed by workers other than their owner, one list per bucket.
+   Other workers push with compare-and-swap; the owner takes a whole list
+   at once when it runs out of free pieces. */
+struct im_remote_queue {
+    void *_Atomic head[NUM_BUCKETS];
+} __attribute__((aligned(CILK_CACHE_LINE)));
+
+/* A magazine is a fixed-size array of free blocks of one bucket.  Workers
+   exchange whole magazines with the global depot. */
+struct im_magazine {
+    _Atomic uint32_t next; // depot stack link, index + 1 or 0
+    uint32_t index;        // 1-based index of this magazine in its depot
+    unsigned int capacity;
+    unsigned int count;
+    void *rounds[];
+};
+
+/* The global depot of one bucket: lock-free stacks of full and empty
+   magazines.  A stack head packs a 1-based magazine index into the low 32
+   bits and an ABA tag into the high 32 bits.  Magazines are never freed
+   while the runtime is running, so a stale index is always safe to read. */
+struct im_depot {
+    _Atomic uint64_t full __attribute__((aligned(CILK_CACHE_LINE)));
+    _Atomic uint64_t empty __attribute__((aligned(CILK_CACHE_LINE)));
+    _Atomic uint32_t num_magazines __attribute__((aligned(CILK_CACHE_LINE)));
+    _Atomic long free_blocks; // blocks in magazines on the full stack
+    // Blocks taken from the depot by callers outside of workers, less blocks
+    // they returned; negative if they freed blocks allocated by workers
+    _Atomic long outside;
+    unsigned int rounds;      // capacity of a magazine
+    size_t stride;            // bytes per magazine
+    char *_Atomic *segments;  // IM_MAGAZINE_SEGMENTS arrays of magazines
+};
+
+/* Magazines for callers outside of workers on one CPU, one per bucket.  The
+   caller that sets busy owns the magazines; a caller that finds busy set,
+   because it was preempted or raced with a thread that migrated, uses the
+   depot instead. */
+struct im_cpu_cache {
+    _Atomic bool busy;
+    struct im_magazine *loaded[NUM_BUCKETS];
+} __attribute__((aligned(CILK_CACHE_LINE)));
+
 struct im_bucket {
-    void *free_list;          // beginning of free list
-    unsigned free_list_size;  // Current size of free list
+    struct im_magazine *loaded;   // allocate from and free into this one
+    struct im_magazine *previous; // full or empty; swapped with loaded
+    struct im_span *span; // span being carved, or NULL
+    char *span_begin; // beginning of the uncarved part of the current span
+    char *span_end;   // end of the current span
+    unsigned free_list_size;  // Blocks in loaded and previous
     unsigned free_list_limit; // Maximum allowed size of free list
     // Allocation count and wasted space on a worker may be negative
-    // if it frees blocks allocated elsewhere.  In a global bucket
-    // these fields should never be negative.
+    // if it frees blocks allocated elsewhere.
     int allocated;     // Current allocations, in use or free
     int max_allocated; // high watermark of allocated
     long wasted;       // in bytes
 };
 
-/* One of these per worker, and one global */
+/* One of these per worker */
 struct cilk_im_desc {
     struct im_bucket buckets[NUM_BUCKETS];
     long used; // local alloc - local free, may be negative
     long num_malloc[IM_NUM_TAGS];
+    long remote_sent;     // bytes freed to other workers' remote queues
+    long remote_received; // bytes taken from this worker's remote queue
 };
 
 #endif /* _INTERAL_MALLOC_IMPL_H */
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE // For sched_getcpu from sched.h
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -6,31 +7,73 @@
 #include <unistd.h> /* sysconf */
 
 #include "cilk-internal.h"
+#include "closure-type.h"
 #include "debug.h"
 #include "global.h"
 #include "local.h"
 
+#if ENABLE_PERCPU_CACHE
+#include <sched.h>
+#ifdef __GLIBC__
+#if __GLIBC_PREREQ(2, 35) /* glibc registers rseq for every thread */
+#include <sys/rseq.h>
+#define HAVE_RSEQ 1
+#endif
+#endif
+#endif
+
 CHEETAH_INTERNAL int cheetah_page_shift = 0;
 
 #define MEM_LIST_SIZE 8U
-#define INTERNAL_MALLOC_CHUNK_SIZE (32 * 1024)
+/* Magazines are created IM_MAGAZINES_PER_SEGMENT at a time, and a depot
+   holds at most IM_MAGAZINE_SEGMENTS such arrays. */
+#define IM_MAGAZINES_PER_SEGMENT 256U
+#define IM_MAGAZINE_SEGMENTS 4096U
+#define IM_CHUNK_SHIFT (IM_SPAN_SHIFT + 3)
+#define INTERNAL_MALLOC_CHUNK_SIZE ((size_t)1 << IM_CHUNK_SHIFT)
+#define INTERNAL_MALLOC_MAX_CHUNK_SIZE (2 * 1024 * 1024)
 #define SIZE_THRESH bucket_sizes[NUM_BUCKETS - 1]
 
-/* TODO: Use sizeof(fiber), sizeof(closure), etc. */
-/* NOTE: Allocator does not currently work with non-power-of-2 bucket sizes in
- * the mix. */
-static const unsigned int bucket_sizes[NUM_BUCKETS] = {32,  64,   128, 256,
-                                                       512, 1024, 2048};
+/* Bucket sizes are multiples of SIZE_CLASS_GRANULE, which lets
+   size_to_bucket() use a table lookup. */
+#define SIZE_CLASS_GRANULE_SHIFT 4
+#define SIZE_CLASS_GRANULE (1U << SIZE_CLASS_GRANULE_SHIFT)
+
+/* Size classes fitted to the objects the runtime allocates.  Besides powers
+   of 2, every multiple of the cache line up to 5 cache lines has its own
+   class, so that a Closure, whose size is a multiple of CILK_CACHE_LINE, fits
+   exactly.  The classes in between powers of 2 cover hypertable bucket arrays
+   and the common sizes of reducer views.  A block is aligned to the largest
+   power of 2 dividing its size, up to CILK_CACHE_LINE. */
+static const unsigned int bucket_sizes[NUM_BUCKETS] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 640, 768, 1024, 1536, 2048};
 static const unsigned int bucket_capacity[NUM_BUCKETS] = {
+    256, /*   16 bytes a piece; 1 page */
     256, /*   32 bytes a piece; 2 pages */
+    128, /*   48 bytes a piece; 1.5 pages */
     128, /*   64 bytes a piece; 2 pages */
+    64,  /*   96 bytes a piece; 1.5 pages */
     64,  /*  128 bytes a piece; 2 pages */
+    64,  /*  192 bytes a piece; 3 pages */
     64,  /*  256 bytes a piece; 4 pages */
+    48,  /*  384 bytes a piece; 4.5 pages */
     32,  /*  512 bytes a piece; 4 pages */
+    24,  /*  640 bytes a piece; 3.75 pages */
+    24,  /*  768 bytes a piece; 4.5 pages */
     16,  /* 1024 bytes a piece; 4 pages */
+    12,  /* 1536 bytes a piece; 4.5 pages */
     8    /* 2048 bytes a piece; 4 pages */
 };
 
+_Static_assert(sizeof(Closure) <= 2048 &&
+                   sizeof(Closure) % CILK_CACHE_LINE == 0 &&
+                   (sizeof(Closure) <= 5 * CILK_CACHE_LINE ||
+                    (sizeof(Closure) & (sizeof(Closure) - 1)) == 0),
+               "Closure does not have an exact internal-malloc size class");
+
+/* Map from size, in SIZE_CLASS_GRANULE units rounded up, to bucket. */
+static unsigned char size_class_table[(2048 >> SIZE_CLASS_GRANULE_SHIFT) + 1];
+
 struct free_block {
     void *next;
 };
@@ -44,41 +87,228 @@ static inline int is_page_aligned(size_t size) {
     return ((size & mask) == 0);
 }
 
-static inline unsigned int size_to_bucket(size_t size) {
-    /* TODO: If sizes are powers of 2 use ffs() */
-    for (unsigned int i = 0; i < NUM_BUCKETS; i++) {
-        if (size <= bucket_sizes[i]) {
-            return i;
-        }
+static void init_size_class_table(void) {
+    unsigned int bucket = 0;
+    for (unsigned int i = 0;
+         i < sizeof(size_class_table) / sizeof(size_class_table[0]); i++) {
+        while (bucket_sizes[bucket] < (i << SIZE_CLASS_GRANULE_SHIFT))
+            ++bucket;
+        size_class_table[i] = bucket;
     }
-    return -1; /* = infinity */
+}
+
+static inline unsigned int size_to_bucket(size_t size) {
+    if (size > SIZE_THRESH)
+        return -1; /* = infinity */
+    return size_class_table[(size + SIZE_CLASS_GRANULE - 1) >>
+                            SIZE_CLASS_GRANULE_SHIFT];
 }
 
 static inline unsigned int bucket_to_size(int which_bucket) {
-    /* TODO: 1U << (which_bucket + 5) */
     return bucket_sizes[which_bucket];
 }
 
+/* Alignment of the blocks in a bucket: the largest power of 2 dividing the
+   bucket size, up to CILK_CACHE_LINE. */
+static inline size_t bucket_to_alignment(int which_bucket) {
+    size_t size = bucket_sizes[which_bucket];
+    size_t align = size & -size;
+    return align < CILK_CACHE_LINE ? align : CILK_CACHE_LINE;
+}
+
+//=========================================================
+// Magazines and the global depot
+//=========================================================
+
+#define MAGAZINE_INDEX_MASK ((uint64_t)0xffffffff)
+#define MAGAZINE_TAG_ONE ((uint64_t)1 << 32)
+
+static inline struct im_magazine *depot_magazine(struct im_depot *depot,
+                                                 uint32_t index) {
+    uint32_t i = index - 1;
+    char *segment = atomic_load_explicit(
+        &depot->segments[i / IM_MAGAZINES_PER_SEGMENT], memory_order_acquire);
+    return (struct im_magazine *)(segment + (size_t)(i %
+                                                     IM_MAGAZINES_PER_SEGMENT) *
+                                                depot->stride);
+}
+
+static void depot_push(_Atomic uint64_t *stack, struct im_magazine *m) {
+    uint64_t old = atomic_load_explicit(stack, memory_order_relaxed);
+    uint64_t new;
+    do {
+        atomic_store_explicit(&m->next, (uint32_t)(old & MAGAZINE_INDEX_MASK),
+                              memory_order_relaxed);
+        new = ((old & ~MAGAZINE_INDEX_MASK) + MAGAZINE_TAG_ONE) | m->index;
+    } while (!atomic_compare_exchange_weak_explicit(
+        stack, &old, new, memory_order_release, memory_order_relaxed));
+}
+
+static struct im_magazine *depot_pop(struct im_depot *depot,
+                                     _Atomic uint64_t *stack) {
+    uint64_t old = atomic_load_explicit(stack, memory_order_acquire);
+    uint64_t new;
+    struct im_magazine *m;
+    do {
+        uint32_t index = (uint32_t)(old & MAGAZINE_INDEX_MASK);
+        if (index == 0)
+            return NULL;
+        m = depot_magazine(depot, index);
+        uint32_t next = atomic_load_explicit(&m->next, memory_order_relaxed);
+        new = ((old & ~MAGAZINE_INDEX_MASK) + MAGAZINE_TAG_ONE) | next;
+    } while (!atomic_compare_exchange_weak_explicit(
+        stack, &old, new, memory_order_acquire, memory_order_acquire));
+    return m;
+}
+
+/* Take a full magazine, or return NULL if the depot has none. */
+static struct im_magazine *depot_get_full(struct im_depot *depot) {
+    struct im_magazine *m = depot_pop(depot, &depot->full);
+    if (m)
+        atomic_fetch_sub_explicit(&depot->free_blocks, m->count,
+                                  memory_order_relaxed);
+    return m;
+}
+
+/* Give a magazine, full or partially full, to the depot. */
+static void depot_put_full(struct im_depot *depot, struct im_magazine *m) {
+    atomic_fetch_add_explicit(&depot->free_blocks, m->count,
+                              memory_order_relaxed);
+    depot_push(&depot->full, m);
+}
+
+/* Take an empty magazine, creating one if the depot has none. */
+static struct im_magazine *depot_get_empty(global_state *g,
+                                           struct im_depot *depot) {
+    struct im_magazine *m = depot_pop(depot, &depot->empty);
+    if (m)
+        return m;
+
+    uint32_t i = atomic_fetch_add_explicit(&depot->num_magazines, 1,
+                                           memory_order_relaxed);
+    unsigned int s = i / IM_MAGAZINES_PER_SEGMENT;
+    CILK_CHECK(g, s < IM_MAGAZINE_SEGMENTS,
+               "Too many internal malloc magazines of %u blocks",
+               depot->rounds);
+    char *segment =
+        atomic_load_explicit(&depot->segments[s], memory_order_acquire);
+    if (!segment) {
+        size_t bytes = IM_MAGAZINES_PER_SEGMENT * depot->stride;
+        char *fresh = cilk_aligned_alloc(
+            CILK_CACHE_LINE, round_size_to_alignment(CILK_CACHE_LINE, bytes));
+        CILK_CHECK(g, fresh, "Cannot allocate %zu bytes for magazines",
+                   bytes);
+        if (atomic_compare_exchange_strong_explicit(
+                &depot->segments[s], &segment, fresh, memory_order_acq_rel,
+                memory_order_acquire))
+            segment = fresh;
+        else
+            free(fresh); // another worker installed the segment
+    }
+    m = (struct im_magazine *)(segment + (size_t)(i %
+                                                  IM_MAGAZINES_PER_SEGMENT) *
+                                             depot->stride);
+    m->index = i + 1;
+    m->capacity = depot->rounds;
+    m->count = 0;
+    return m;
+}
+
+static void depot_put_empty(struct im_depot *depot, struct im_magazine *m) {
+    CILK_ASSERT(m->count == 0);
+    depot_push(&depot->empty, m);
+}
+
+/* Give one free block to the depot. */
+static void depot_put_block(global_state *g, struct im_depot *depot,
+                            void *p) {
+    struct im_magazine *m = depot_get_full(depot);
+    if (m && m->count == m->capacity) {
+        depot_put_full(depot, m);
+        m = NULL;
+    }
+    if (!m)
+        m = depot_get_empty(g, depot);
+    m->rounds[m->count++] = p;
+    depot_put_full(depot, m);
+}
+
+static void init_depot(struct im_depot *depot, unsigned int which_bucket) {
+    atomic_init(&depot->full, 0);
+    atomic_init(&depot->empty, 0);
+    atomic_init(&depot->num_magazines, 0);
+    atomic_init(&depot->free_blocks, 0);
+    atomic_init(&depot->outside, 0);
+    depot->rounds = bucket_capacity[which_bucket] / 2;
+    depot->stride = round_size_to_alignment(
+        __alignof__(struct im_magazine),
+        sizeof(struct im_magazine) + depot->rounds * sizeof(void *));
+    depot->segments = calloc(IM_MAGAZINE_SEGMENTS, sizeof(*depot->segments));
+}
+
+static void destroy_depot(struct im_depot *depot) {
+    for (unsigned int s = 0; s < IM_MAGAZINE_SEGMENTS; ++s)
+        free(depot->segments[s]);
+    free(depot->segments);
+    depot->segments = NULL;
+}
+
+/* Free blocks of the depot, including those in per-CPU caches. */
+static size_t depot_free_bytes(global_state *g) {
+    size_t free = 0;
+    for (unsigned i = 0; i < NUM_BUCKETS; ++i)
+        free += (size_t)atomic_load_explicit(&g->im_depot[i].free_blocks,
+                                             memory_order_relaxed) *
+                bucket_sizes[i];
+#if ENABLE_PERCPU_CACHE
+    for (unsigned int c = 0; c < g->im_num_cpus; ++c)
+        for (unsigned i = 0; i < NUM_BUCKETS; ++i) {
+            struct im_magazine *m = g->im_cpu_cache[c].loaded[i];
+            if (m)
+                free += (size_t)m->count * bucket_sizes[i];
+        }
+#endif
+    return free;
+}
+
+/* Free blocks of a worker bucket are in its two magazines.  Allocation
+   takes from loaded, swapping in previous if it is not empty; freeing
+   puts into loaded, swapping in previous if it is not full.  Only when
+   both fail does the worker visit the depot. */
+
 static void add_to_free_list(struct im_bucket *bucket, void *p) {
-    ((struct free_block *)p)->next = bucket->free_list;
-    bucket->free_list = p;
+    struct im_magazine *m = bucket->loaded;
+    if (m->count == m->capacity) {
+        CILK_ASSERT(bucket->previous->count < bucket->previous->capacity);
+        bucket->loaded = bucket->previous;
+        bucket->previous = m;
+        m = bucket->loaded;
+    }
+    m->rounds[m->count++] = p;
     ++bucket->free_list_size;
 }
 
 static void *remove_from_free_list(struct im_bucket *bucket) {
-    void *mem = bucket->free_list;
-    if (mem) {
-        bucket->free_list = ((struct free_block *)mem)->next;
-        --bucket->free_list_size;
+    struct im_magazine *m = bucket->loaded;
+    if (m->count == 0) {
+        if (bucket->previous->count == 0)
+            return NULL;
+        bucket->loaded = bucket->previous;
+        bucket->previous = m;
+        m = bucket->loaded;
     }
-    return mem;
+    --bucket->free_list_size;
+    return m->rounds[--m->count];
 }
 
 /* initialize the buckets in struct cilk_im_desc */
-static void init_im_buckets(struct cilk_im_desc *im_desc) {
+static void init_im_buckets(global_state *g, struct cilk_im_desc *im_desc) {
     for (int i = 0; i < NUM_BUCKETS; i++) {
         struct im_bucket *bucket = &(im_desc->buckets[i]);
-        bucket->free_list = NULL;
+        bucket->loaded = depot_get_empty(g, &g->im_depot[i]);
+        bucket->previous = depot_get_empty(g, &g->im_depot[i]);
+        bucket->span = NULL;
+        bucket->span_begin = bucket->span_end = NULL;
         bucket->free_list_size = 0;
         bucket->free_list_limit = bucket_capacity[i];
         bucket->allocated = 0;
@@ -88,6 +318,8 @@ static void init_im_buckets(struct cilk_im_desc *im_desc) {
     im_desc->used = 0;
     for (int j = 0; j < IM_NUM_TAGS; ++j)
         im_desc->num_malloc[j] = 0;
+    im_desc->remote_sent = 0;
+    im_desc->remote_received = 0;
 }
 
 //=========================================================
@@ -95,10 +327,12 @@ static void init_im_buckets(struct cilk_im_desc *im_desc) {
 //=========================================================
 
 static void dump_buckets(FILE *out, struct cilk_im_desc *d) {
-    fprintf(out, "  %zd bytes used\n", d->used);
+    fprintf(out, "  %zd bytes used, %ld sent to and %ld received from "
+                 "other workers\n",
+            d->used, d->remote_sent, d->remote_received);
     for (unsigned i = 0; i < NUM_BUCKETS; ++i) {
         struct im_bucket *b = &d->buckets[i];
-        if (!b->free_list && !b->free_list_size && !b->allocated)
+        if (!b->free_list_size && !b->allocated)
             continue;
         fprintf(out, "  [%u] %d allocated (%d max, %zd wasted), %u free\n",
                 bucket_to_size(i), b->allocated, b->max_allocated, b->wasted,
@@ -120,9 +354,11 @@ static long wasted_bytes(struct cilk_im_desc *desc) {
     return wasted;
 }
 
-static size_t workers_used_and_free(global_state *g) {
+/* Bytes held by workers, including bytes in remote queues.  A worker that
+   frees blocks taken outside of workers can have negative use and waste. */
+static long workers_used_and_free(global_state *g) {
     size_t worker_free = 0;
-    long worker_used = 0, worker_wasted = 0;
+    long worker_used = 0, worker_wasted = 0, remote = 0;
     for (unsigned int i = 0; i < g->nworkers; i++) {
         __cilkrts_worker *w = g->workers[i];
         if (!w)
@@ -131,32 +367,100 @@ static size_t workers_used_and_free(global_state *g) {
         worker_free += free_bytes(&l->im_desc);
         worker_used += l->im_desc.used;
         worker_wasted += wasted_bytes(&l->im_desc);
+        remote += l->im_desc.remote_sent - l->im_desc.remote_received;
+    }
+    CILK_ASSERT(remote >= 0);
+    return worker_used + (long)worker_free + worker_wasted + remote;
+}
+
+/* Bytes of spans not yet carved by workers. */
+static size_t workers_uncarved(global_state *g) {
+    size_t uncarved = 0;
+    for (unsigned int i = 0; i < g->nworkers; i++) {
+        __cilkrts_worker *w = g->workers[i];
+        if (!w || !w->l)
+            continue;
+        for (unsigned int j = 0; j < NUM_BUCKETS; ++j) {
+            struct im_bucket *b = &w->l->im_desc.buckets[j];
+            uncarved += b->span_end - b->span_begin;
+        }
     }
-    CILK_ASSERT(worker_used >= 0 && worker_wasted >= 0);
-    return worker_used + worker_free + worker_wasted;
+    return uncarved;
+}
+
+static size_t global_available(struct global_im_pool *pool) {
+    uintptr_t spans = atomic_load_explicit(&pool->spans, memory_order_relaxed);
+    return (spans & (IM_SPAN_SIZE - 1)) * IM_SPAN_SIZE;
+}
+
+/* Bytes taken from the depot by callers outside of workers. */
+static long outside_used_bytes(global_state *g) {
+    long used = 0;
+    for (unsigned i = 0; i < NUM_BUCKETS; ++i)
+        used += atomic_load_explicit(&g->im_depot[i].outside,
+                                     memory_order_relaxed) *
+                (long)bucket_sizes[i];
+    return used;
+}
+
+/* Bytes carved from the pool and not in the depot, i.e., held by workers or
+   by callers outside of workers. */
+static size_t global_used_bytes(global_state *g) {
+    return atomic_load_explicit(&g->im_pool.carved, memory_order_relaxed) -
+           depot_free_bytes(g);
 }
 
 CHEETAH_INTERNAL
 void dump_memory_state(FILE *out, global_state *g) {
     if (out == NULL)
         out = stderr;
-    size_t global_free = free_bytes(&g->im_desc);
-    ptrdiff_t available =
-        (char *)g->im_pool.mem_end - (char *)g->im_pool.mem_begin;
+    size_t global_free = depot_free_bytes(g);
+    size_t available = global_available(&g->im_pool);
+    size_t global_used = global_used_bytes(g);
+    size_t uncarved = workers_uncarved(g);
+    size_t wasted = atomic_load_explicit(&g->im_pool.wasted,
+                                         memory_order_relaxed);
     fprintf(out,
             "Global memory:\n  %zu allocated in %u blocks (%zu wasted)\n"
-            "  %zd used + %tu available + %zu free = %zu\n",
-            g->im_pool.allocated, g->im_pool.mem_list_index + 1,
-            g->im_pool.wasted, g->im_desc.used, available, global_free,
-            g->im_desc.used + available + global_free);
-    dump_buckets(out, &g->im_desc);
+            "  %zu used + %zu available + %zu uncarved + %zu free = %zu\n",
+            g->im_pool.allocated, g->im_pool.mem_list_index + 1, wasted,
+            global_used, available, uncarved, global_free,
+            global_used + available + uncarved + global_free);
+    for (unsigned i = 0; i < NUM_BUCKETS; ++i) {
+        struct im_depot *depot = &g->im_depot[i];
+        long free_blocks = atomic_load_explicit(&depot->free_blocks,
+                                                memory_order_relaxed);
+        if (!free_blocks)
+            continue;
+        fprintf(out, "  [%u] %ld free in depot (%u magazines)\n",
+                bucket_to_size(i), free_blocks,
+                atomic_load_explicit(&depot->num_magazines,
+                                     memory_order_relaxed));
+    }
+    long internal_waste = 0;
+    long in_use = 0;
     for (unsigned int i = 0; i < g->nworkers; i++) {
         __cilkrts_worker *w = g->workers[i];
-        if (!w)
+        if (!w || !w->l)
             continue;
         fprintf(out, "Worker %u:\n", i);
         dump_buckets(out, &w->l->im_desc);
+        internal_waste += wasted_bytes(&w->l->im_desc);
+        in_use += w->l->im_desc.used;
     }
+    /* Internal waste is the difference between requested sizes and the
+       size classes that served them; pool waste is span headers and tails
+       and alignment padding. */
+    fprintf(out,
+            "Waste:\n  %ld bytes internal (%.1f%% of %ld in use), "
+            "%zu bytes in pool (%.1f%% of %zu)\n",
+            internal_waste,
+            in_use > 0 ? 100.0 * internal_waste / in_use : 0.0, in_use,
+            wasted,
+            g->im_pool.allocated > 0
+                ? 100.0 * wasted / g->im_pool.allocated
+                : 0.0,
+            g->im_pool.allocated);
 }
 
 void dump_memory_state_stderr(global_state *g) { dump_memory_state(stderr, g); }
@@ -167,11 +471,9 @@ void internal_malloc_global_check(global_state *g) {
        global used = worker used + free
        global used + global free = allocated. */
 
-    struct cilk_im_desc *d = &(g->im_desc);
-
     size_t total_malloc[IM_NUM_TAGS];
     for (int i = 0; i < IM_NUM_TAGS; ++i)
-        total_malloc[i] = d->num_malloc[i];
+        total_malloc[i] = g->im_num_malloc[i];
 
     for (unsigned int i = 0; i < g->nworkers; i++) {
         __cilkrts_worker *w = g->workers[i];
@@ -183,24 +485,25 @@ void internal_malloc_global_check(global_state *g) {
     }
 
     size_t allocated = g->im_pool.allocated;
-    CILK_ASSERT(g->im_desc.used >= 0);
-    size_t global_used = g->im_desc.used;
-    size_t global_free = free_bytes(&g->im_desc);
-    size_t worker_total = workers_used_and_free(g);
-    size_t global_available =
-        (char *)g->im_pool.mem_end - (char *)g->im_pool.mem_begin;
-
-    if (global_used != worker_total ||
-        global_used + global_free + global_available != allocated)
+    size_t global_used = global_used_bytes(g);
+    size_t global_free = depot_free_bytes(g);
+    long worker_total = workers_used_and_free(g) + outside_used_bytes(g);
+    CILK_ASSERT(worker_total >= 0);
+    size_t available = global_available(&g->im_pool) + workers_uncarved(g);
+    size_t global_wasted = g->im_pool.wasted;
+
+    if (global_used != (size_t)worker_total ||
+        global_used + global_free + available + global_wasted != allocated)
         dump_memory_state(stderr, g);
 
     CILK_CHECK(g,
-               global_used + global_free + global_available == allocated &&
-                   global_used == worker_total,
-               "Possible memory leak: %zu+%zu+%zu global used+free+available, "
-               "%zu allocated, %zu in workers",
-               global_used, global_free, global_available, allocated,
-               worker_total);
+               global_used + global_free + available + global_wasted ==
+                       allocated &&
+                   global_used == (size_t)worker_total,
+               "Possible memory leak: %zu+%zu+%zu+%zu global "
+               "used+free+available+wasted, %zu allocated, %ld in workers",
+               global_used, global_free, available, global_wasted,
+               allocated, worker_total);
 }
 
 static void assert_global_pool(struct global_im_pool *pool) {
@@ -210,7 +513,8 @@ static void assert_global_pool(struct global_im_pool *pool) {
 }
 
 static void assert_bucket(struct im_bucket *bucket) {
-    CILK_ASSERT(!!bucket->free_list == !!bucket->free_list_size);
+    CILK_ASSERT(bucket->loaded->count + bucket->previous->count ==
+                bucket->free_list_size);
     CILK_ASSERT_LE(bucket->free_list_size, bucket->free_list_limit, "%u");
     CILK_ASSERT_LE(bucket->allocated, bucket->max_allocated, "%d");
 }
@@ -245,6 +549,16 @@ static void print_worker_buckets_hwm(__cilkrts_worker *w, void *data) {
     fprintf(fp, "\n");
 }
 
+static void print_worker_balance(__cilkrts_worker *w, void *data) {
+    FILE *fp = (FILE *)data;
+    struct cilk_im_desc *d = &w->l->im_desc;
+    long allocated = 0;
+    for (unsigned int j = 0; j < NUM_BUCKETS; j++)
+        allocated += (long)d->buckets[j].allocated * bucket_sizes[j];
+    fprintf(fp, WORKER_HDR_DESC "%12ld%12ld%12ld%12ld\n", "Worker", w->self,
+            d->used, allocated, d->remote_sent, d->remote_received);
+}
+
 static void print_im_buckets_stats(struct global_state *g) {
     fprintf(stderr, "\nBYTES IN FREE LISTS:\n");
     fprintf(stderr, HDR_DESC, "Bucket size:");
@@ -257,7 +571,9 @@ static void print_im_buckets_stats(struct global_state *g) {
     fprintf(stderr, HDR_DESC, "Global:");
     for (unsigned int j = 0; j < NUM_BUCKETS; j++) {
         fprintf(stderr, FIELD_DESC,
-                (size_t)g->im_desc.buckets[j].free_list_size * bucket_sizes[j]);
+                (size_t)atomic_load_explicit(&g->im_depot[j].free_blocks,
+                                             memory_order_relaxed) *
+                    bucket_sizes[j]);
     }
     fprintf(stderr, "\n");
     for_each_worker(g, &print_worker_buckets_free, stderr);
@@ -271,6 +587,16 @@ static void print_im_buckets_stats(struct global_state *g) {
                     "---------------------------------------------\n");
     for_each_worker(g, &print_worker_buckets_hwm, stderr);
 
+    /* Blocks freed by a worker other than their owner return to the owner
+       through its remote queue instead of migrating to the freeing worker,
+       so allocated bytes should stay close to bytes in use. */
+    fprintf(stderr, "\nPER-WORKER BALANCE IN BYTES:\n");
+    fprintf(stderr, HDR_DESC "%12s%12s%12s%12s", "", "Used", "Allocated",
+            "Sent", "Received");
+    fprintf(stderr, "\n-------------------------------------------"
+                    "---------------------------------------------\n");
+    for_each_worker(g, &print_worker_balance, stderr);
+
     fprintf(stderr, "\n");
 }
 
@@ -282,7 +608,10 @@ static void print_internal_malloc_stats(struct global_state *g) {
             g->im_pool.allocated / 1024,
             (g->im_pool.allocated + page_size - 1) / page_size);
     fprintf(stderr, "Total bytes allocated but wasted:  %7zu KBytes\n",
-            g->im_pool.wasted / 1024);
+            atomic_load_explicit(&g->im_pool.wasted, memory_order_relaxed) /
+                1024);
+    fprintf(stderr, "Total bytes returned to system:    %7zu KBytes\n",
+            g->im_pool.released / 1024);
     print_im_buckets_stats(g);
     fprintf(stderr, "\n");
 }
@@ -291,7 +620,7 @@ static void print_internal_malloc_stats(struct global_state *g) {
 // Global memory allocator
 //=========================================================
 
-static char *malloc_from_system(__cilkrts_worker *w, size_t size) {
+static char *malloc_from_system(global_state *g, size_t size) {
     void *mem;
     if (is_page_aligned(size)) {
         mem = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
@@ -299,7 +628,7 @@ static char *malloc_from_system(__cilkrts_worker *w, size_t size) {
     } else {
         mem = malloc(size);
     }
-    CILK_CHECK(w->g, mem, "Internal malloc failed to allocate %zu bytes", size);
+    CILK_CHECK(g, mem, "Internal malloc failed to allocate %zu bytes", size);
     return mem;
 }
 
@@ -311,17 +640,122 @@ static void free_to_system(void *p, size_t size) {
     }
 }
 
+/* Allocate a memory block for the global pool, aligned to its size so
+   that a maximum size block can be backed by a huge page. */
+static char *chunk_from_system(global_state *g, size_t size) {
+    char *mem = mmap(0, 2 * size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    CILK_CHECK(g, mem != MAP_FAILED,
+               "Internal malloc failed to allocate %zu bytes", size);
+    char *aligned = (char *)round_size_to_alignment(size, (uintptr_t)mem);
+    if (aligned > mem)
+        munmap(mem, aligned - mem);
+    munmap(aligned + size, mem + size - aligned);
+#ifdef MADV_HUGEPAGE
+    if (size >= INTERNAL_MALLOC_MAX_CHUNK_SIZE)
+        madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+    return aligned;
+}
+
+/* Map of the address space, in units of the smallest chunk, marking the
+   chunks of the pool.  It tells blocks of the pool from blocks cilk_malloc
+   took from malloc, before the runtime started, without touching them.
+   Leaves are never freed, so lookups need no lock; a block being freed keeps
+   its chunk mapped.  Chunks stay marked after the pool is destroyed, so that
+   freeing their blocks later is harmless. */
+#define IM_MAP_ADDRESS_BITS 48
+#define IM_MAP_LEAF_BITS 15
+#define IM_MAP_ROOT_BITS \
+    (IM_MAP_ADDRESS_BITS - IM_CHUNK_SHIFT - IM_MAP_LEAF_BITS)
+#define IM_MAP_LEAF_WORDS ((1U << IM_MAP_LEAF_BITS) / 64)
+
+static _Atomic uint64_t *_Atomic im_chunk_map[1U << IM_MAP_ROOT_BITS];
+
+/* Mark or unmark the chunk [mem, mem + size).  Called with im_lock held. */
+static void im_chunk_map_set(global_state *g, char *mem, size_t size,
+                             bool in_pool) {
+    uintptr_t end = ((uintptr_t)mem + size) >> IM_CHUNK_SHIFT;
+    for (uintptr_t u = (uintptr_t)mem >> IM_CHUNK_SHIFT; u < end; ++u) {
+        uintptr_t root = u >> IM_MAP_LEAF_BITS;
+        CILK_CHECK(g, root < (1U << IM_MAP_ROOT_BITS),
+                   "Internal malloc chunk at %p is out of range", mem);
+        _Atomic uint64_t *leaf =
+            atomic_load_explicit(&im_chunk_map[root], memory_order_relaxed);
+        if (!leaf) {
+            leaf = calloc(IM_MAP_LEAF_WORDS, sizeof(uint64_t));
+            CILK_CHECK(g, leaf, "Cannot allocate %zu bytes for the internal "
+                       "malloc map", IM_MAP_LEAF_WORDS * sizeof(uint64_t));
+            atomic_store_explicit(&im_chunk_map[root], leaf,
+                                  memory_order_release);
+        }
+        uintptr_t i = u & ((1U << IM_MAP_LEAF_BITS) - 1);
+        uint64_t bit = (uint64_t)1 << (i % 64);
+        if (in_pool)
+            atomic_fetch_or_explicit(&leaf[i / 64], bit, memory_order_relaxed);
+        else
+            atomic_fetch_and_explicit(&leaf[i / 64], ~bit,
+                                      memory_order_relaxed);
+    }
+}
+
+/* Whether p lies in a chunk of the pool. */
+static inline bool im_pool_owns(const void *p) {
+    uintptr_t u = (uintptr_t)p >> IM_CHUNK_SHIFT;
+    uintptr_t root = u >> IM_MAP_LEAF_BITS;
+    if (root >= (1U << IM_MAP_ROOT_BITS))
+        return false;
+    _Atomic uint64_t *leaf =
+        atomic_load_explicit(&im_chunk_map[root], memory_order_acquire);
+    if (!leaf)
+        return false;
+    uintptr_t i = u & ((1U << IM_MAP_LEAF_BITS) - 1);
+    return (atomic_load_explicit(&leaf[i / 64], memory_order_relaxed) >>
+            (i % 64)) & 1;
+}
+
+static inline struct im_span *span_of(void *p) {
+    return (struct im_span *)((uintptr_t)p & ~(IM_SPAN_SIZE - 1));
+}
+
+/* Chunk spans field: spans taken from the pool in the high bits, spans not
+   yet closed by the worker carving them in the low bits. */
+#define CHUNK_SPAN_TAKEN 0x10000U
+#define CHUNK_SPAN_OPEN_MASK 0xffffU
+
 /**
  * Extend the global im pool.  This function is only called when the
- * current chunk in use is not big enough to satisfy an allocation.
- * The size is already canonicalized at this point.
+ * current chunk, with span state old, has no free spans.  If another
+ * worker has already replaced it, there is nothing to do.  Chunks double
+ * in size with the pool, up to INTERNAL_MALLOC_MAX_CHUNK_SIZE.
  */
-static void extend_global_pool(__cilkrts_worker *w) {
+static void extend_global_pool(global_state *g, uintptr_t old) {
 
-    struct global_im_pool *im_pool = &(w->g->im_pool);
-    im_pool->mem_begin = malloc_from_system(w, INTERNAL_MALLOC_CHUNK_SIZE);
-    im_pool->mem_end = im_pool->mem_begin + INTERNAL_MALLOC_CHUNK_SIZE;
-    im_pool->allocated += INTERNAL_MALLOC_CHUNK_SIZE;
+    struct global_im_pool *im_pool = &(g->im_pool);
+    cilk_mutex_lock(&(g->im_lock));
+    if (atomic_load_explicit(&im_pool->spans, memory_order_relaxed) != old) {
+        cilk_mutex_unlock(&(g->im_lock));
+        return;
+    }
+
+    size_t size = INTERNAL_MALLOC_CHUNK_SIZE;
+    while (size < im_pool->allocated && size < INTERNAL_MALLOC_MAX_CHUNK_SIZE)
+        size *= 2;
+    struct im_chunk *chunk = malloc(sizeof(*chunk));
+    CILK_CHECK(g, chunk, "Cannot allocate %zu bytes for a chunk record",
+               sizeof(*chunk));
+    char *mem = chunk_from_system(g, size);
+    im_chunk_map_set(g, mem, size, true);
+    chunk->mem = mem;
+    chunk->size = size;
+    atomic_init(&chunk->spans, 0);
+    atomic_init(&chunk->carved, 0);
+    atomic_init(&chunk->wasted, 0);
+    chunk->held = 0;
+    chunk->releasing = false;
+    for (char *span = mem; span < mem + size; span += IM_SPAN_SIZE)
+        ((struct im_span *)span)->chunk = chunk;
+    im_pool->allocated += size;
     im_pool->mem_list_index++;
 
     if (im_pool->mem_list_index >= im_pool->mem_list_size) {
@@ -329,61 +763,162 @@ static void extend_global_pool(__cilkrts_worker *w) {
         size_t new_list_size = 2 * im_pool->mem_list_size;
         im_pool->mem_list = realloc(im_pool->mem_list,
                                     new_list_size * sizeof(*im_pool->mem_list));
+        CILK_CHECK(g, im_pool->mem_list,
+                   "Failed to extend global memory list by %zu bytes",
+                   im_pool->mem_list_size * sizeof(*im_pool->mem_list));
         for (size_t i = im_pool->mem_list_size; i < new_list_size; ++i) {
             im_pool->mem_list[i] = 0;
         }
         im_pool->mem_list_size = new_list_size;
-        CILK_CHECK(w->g, im_pool->mem_list,
-                   "Failed to extend global memory list by %zu bytes",
-                   MEM_LIST_SIZE * sizeof(*im_pool->mem_list));
     }
-    im_pool->mem_list[im_pool->mem_list_index] = im_pool->mem_begin;
+    im_pool->mem_list[im_pool->mem_list_index] = chunk;
+    atomic_store_explicit(&im_pool->spans,
+                          (uintptr_t)mem | (size / IM_SPAN_SIZE),
+                          memory_order_release);
+    cilk_mutex_unlock(&(g->im_lock));
 }
 
 /**
- * Allocate a piece of memory of 'size' from global im bucket 'bucket'.
- * The free_list is last-in-first-out.
+ * Take a span from the global pool.  A single compare-and-swap claims the
+ * span; the lock is only taken to replace an exhausted chunk.  The span is
+ * open until the worker carving it calls close_span.
+ */
+static char *global_im_alloc_span(global_state *g) {
+    struct global_im_pool *im_pool = &(g->im_pool);
+    uintptr_t spans = atomic_load_explicit(&im_pool->spans, memory_order_acquire);
+    while (true) {
+        if (spans & (IM_SPAN_SIZE - 1)) {
+            // Advance to the next span and decrement the count of free spans.
+            if (atomic_compare_exchange_weak_explicit(
+                    &im_pool->spans, &spans, spans + IM_SPAN_SIZE - 1,
+                    memory_order_acquire, memory_order_acquire)) {
+                char *span = (char *)(spans & ~(IM_SPAN_SIZE - 1));
+                atomic_fetch_add_explicit(&span_of(span)->chunk->spans,
+                                          CHUNK_SPAN_TAKEN | 1,
+                                          memory_order_relaxed);
+                return span;
+            }
+            continue;
+        }
+        extend_global_pool(g, spans);
+        spans = atomic_load_explicit(&im_pool->spans, memory_order_acquire);
+    }
+}
+
+/* Account for bytes of a span carved into pieces or wasted. */
+static void span_carved(global_state *g, struct im_span *span, size_t carved,
+                        size_t wasted) {
+    if (carved) {
+        atomic_fetch_add_explicit(&g->im_pool.carved, carved,
+                                  memory_order_relaxed);
+        atomic_fetch_add_explicit(&span->chunk->carved, carved,
+                                  memory_order_relaxed);
+    }
+    if (wasted) {
+        atomic_fetch_add_explicit(&g->im_pool.wasted, wasted,
+                                  memory_order_relaxed);
+        atomic_fetch_add_explicit(&span->chunk->wasted, wasted,
+                                  memory_order_relaxed);
+    }
+}
+
+/* Stop carving a span.  The release pairs with cilk_internal_malloc_trim,
+   which reads the chunk counters once no span of the chunk is open. */
+static void close_span(struct im_span *span) {
+    atomic_fetch_sub_explicit(&span->chunk->spans, 1, memory_order_release);
+}
+
+static void im_free_batch(__cilkrts_worker *w, unsigned int which_bucket);
+
+/**
+ * Carve what is left of the span this worker carves for bucket
+ * 'which_bucket' into free pieces for smaller buckets, largest first.
+ * Bytes too small for any bucket are wasted.
+ */
+static void im_recycle_tail(__cilkrts_worker *w, unsigned int which_bucket) {
+    struct im_bucket *bucket = &w->l->im_desc.buckets[which_bucket];
+    char *begin = bucket->span_begin, *end = bucket->span_end;
+    size_t carved = 0;
+    for (int i = (int)which_bucket - 1; i >= 0; --i) {
+        size_t size = bucket_to_size(i);
+        char *p = (char *)round_size_to_alignment(bucket_to_alignment(i),
+                                                  (uintptr_t)begin);
+        if (p + size > end)
+            continue;
+        struct im_bucket *small = &w->l->im_desc.buckets[i];
+        for (; p + size <= end; p += size) {
+            if (small->free_list_size == small->free_list_limit)
+                im_free_batch(w, i);
+            add_to_free_list(small, p);
+            ++small->allocated;
+            carved += size;
+        }
+        if (small->allocated > small->max_allocated)
+            small->max_allocated = small->allocated;
+        begin = p;
+    }
+    span_carved(w->g, bucket->span, carved, (end - bucket->span_begin) - carved);
+    bucket->span_begin = bucket->span_end = NULL;
+}
+
+/**
+ * Fill the empty magazine m with pieces of memory for bucket 'which_bucket'
+ * carved from this worker's span for the bucket, starting a new span if the
+ * current one is exhausted.
  * The size is already canonicalized at this point.
  */
-static void *global_im_alloc(__cilkrts_worker *w, size_t size,
-                             unsigned int which_bucket) {
+static void global_im_alloc(__cilkrts_worker *w, size_t size,
+                            unsigned int which_bucket,
+                            struct im_magazine *m) {
     global_state *g = w->g;
     CILK_ASSERT(g);
     CILK_ASSERT(size <= SIZE_THRESH);
     CILK_ASSERT(which_bucket < NUM_BUCKETS);
+    CILK_ASSERT(m->count == 0);
 
-    struct im_bucket *bucket = &(g->im_desc.buckets[which_bucket]);
-    struct cilk_im_desc *im_desc = &(g->im_desc);
-    im_desc->used += size;
-    /* ??? count calls to this function? */
-
-    void *mem = remove_from_free_list(bucket);
-    if (!mem) {
-        struct global_im_pool *im_pool = &(g->im_pool);
-        // allocate from the global pool
-        if ((im_pool->mem_begin + size) > im_pool->mem_end) {
-            // consider the left over as waste for now
-            // TODO: Adding it to a random free list would be better.
-            im_pool->wasted += im_pool->mem_end - im_pool->mem_begin;
-            extend_global_pool(w);
+    struct im_bucket *bucket = &w->l->im_desc.buckets[which_bucket];
+    if ((size_t)(bucket->span_end - bucket->span_begin) < size) {
+        if (bucket->span) {
+            im_recycle_tail(w, which_bucket);
+            close_span(bucket->span);
         }
-        mem = im_pool->mem_begin;
-        im_pool->mem_begin += size;
+        char *span = global_im_alloc_span(g);
+        struct im_span *header = (struct im_span *)span;
+        header->owner = w->self;
+        header->bucket = which_bucket;
+        char *begin = (char *)round_size_to_alignment(
+            bucket_to_alignment(which_bucket),
+            (uintptr_t)span + sizeof(struct im_span));
+        span_carved(g, header, 0, begin - span);
+        bucket->span = header;
+        bucket->span_begin = begin;
+        bucket->span_end = span + IM_SPAN_SIZE;
     }
-
-    return mem;
+    size_t n = (bucket->span_end - bucket->span_begin) / size;
+    if (n > m->capacity)
+        n = m->capacity;
+    char *mem = bucket->span_begin;
+    for (size_t i = 0; i < n; ++i)
+        m->rounds[i] = mem + (n - 1 - i) * size;
+    m->count = n;
+    bucket->span_begin = mem + n * size;
+    span_carved(g, bucket->span, n * size, 0);
 }
 
 static void global_im_pool_destroy(struct global_im_pool *im_pool) {
 
     for (unsigned i = 0; i < im_pool->mem_list_size; i++) {
-        void *mem = im_pool->mem_list[i];
-        free_to_system(mem, INTERNAL_MALLOC_CHUNK_SIZE);
+        struct im_chunk *chunk = im_pool->mem_list[i];
+        if (!chunk)
+            continue;
+        if (chunk->mem)
+            munmap(chunk->mem, chunk->size);
+        free(chunk);
         im_pool->mem_list[i] = NULL;
     }
     free(im_pool->mem_list);
     im_pool->mem_list = NULL;
-    im_pool->mem_begin = im_pool->mem_end = NULL;
+    atomic_store_explicit(&im_pool->spans, 0, memory_order_relaxed);
     im_pool->mem_list_index = -1;
     im_pool->mem_list_size = 0;
 }
@@ -394,9 +929,10 @@ void cilk_internal_malloc_global_init(global_state *g) {
         /* The global store here should be atomic. */
         cheetah_page_shift = ffs(cheetah_page_size) - 1;
         CILK_ASSERT((1 << cheetah_page_shift) == cheetah_page_size);
+        init_size_class_table();
     }
     cilk_mutex_init(&(g->im_lock));
-    g->im_pool.mem_begin = g->im_pool.mem_end = NULL;
+    atomic_init(&g->im_pool.spans, 0);
     g->im_pool.mem_list_index = -1;
     g->im_pool.mem_list_size = MEM_LIST_SIZE;
     g->im_pool.mem_list = calloc(MEM_LIST_SIZE, sizeof(*g->im_pool.mem_list));
@@ -404,12 +940,40 @@ void cilk_internal_malloc_global_init(global_state *g) {
                "Cannot allocate %u * %zu bytes for mem_list", MEM_LIST_SIZE,
                sizeof(*g->im_pool.mem_list));
     g->im_pool.allocated = 0;
-    g->im_pool.wasted = 0;
-    init_im_buckets(&g->im_desc);
+    g->im_pool.released = 0;
+    atomic_init(&g->im_pool.carved, 0);
+    atomic_init(&g->im_pool.wasted, 0);
+    for (unsigned int i = 0; i < NUM_BUCKETS; ++i) {
+        init_depot(&g->im_depot[i], i);
+        CILK_CHECK(g, g->im_depot[i].segments,
+                   "Cannot allocate %u magazine segments",
+                   IM_MAGAZINE_SEGMENTS);
+    }
+    size_t remote_size = g->options.nproc * sizeof(struct im_remote_queue);
+    g->im_remote = cilk_aligned_alloc(CILK_CACHE_LINE, remote_size);
+    CILK_CHECK(g, g->im_remote, "Cannot allocate %zu bytes for remote queues",
+               remote_size);
+    for (unsigned int i = 0; i < g->options.nproc; ++i)
+        for (unsigned int j = 0; j < NUM_BUCKETS; ++j)
+            atomic_init(&g->im_remote[i].head[j], NULL);
 
-    g->im_desc.used = 0;
     for (int i = 0; i < IM_NUM_TAGS; ++i)
-        g->im_desc.num_malloc[i] = 0;
+        g->im_num_malloc[i] = 0;
+    atomic_init(&g->im_num_user_outside, 0);
+
+#if ENABLE_PERCPU_CACHE
+    long num_cpus = sysconf(_SC_NPROCESSORS_CONF);
+    g->im_num_cpus = num_cpus > 0 ? num_cpus : 1;
+    size_t cache_size = g->im_num_cpus * sizeof(struct im_cpu_cache);
+    g->im_cpu_cache = cilk_aligned_alloc(CILK_CACHE_LINE, cache_size);
+    CILK_CHECK(g, g->im_cpu_cache,
+               "Cannot allocate %zu bytes for per-CPU caches", cache_size);
+    for (unsigned int i = 0; i < g->im_num_cpus; ++i) {
+        atomic_init(&g->im_cpu_cache[i].busy, false);
+        for (unsigned int j = 0; j < NUM_BUCKETS; ++j)
+            g->im_cpu_cache[i].loaded[j] = NULL;
+    }
+#endif
 }
 
 void cilk_internal_malloc_global_terminate(global_state *g) {
@@ -421,10 +985,127 @@ void cilk_internal_malloc_global_terminate(global_state *g) {
 
 void cilk_internal_malloc_global_destroy(global_state *g) {
     global_im_pool_destroy(&(g->im_pool)); // free global mem blocks
+    for (unsigned int i = 0; i < NUM_BUCKETS; ++i)
+        destroy_depot(&g->im_depot[i]);
+    free(g->im_remote);
+    g->im_remote = NULL;
+#if ENABLE_PERCPU_CACHE
+    free(g->im_cpu_cache);
+    g->im_cpu_cache = NULL;
+    g->im_num_cpus = 0;
+#endif
     cilk_mutex_destroy(&(g->im_lock));
     for (int i = 0; i < IM_NUM_TAGS; ++i) {
-        CILK_ASSERT(g->im_desc.num_malloc[i] == 0);
+        // Programs may exit holding cilk_malloc memory.
+        if (i != IM_USER)
+            CILK_ASSERT(g->im_num_malloc[i] == 0);
+    }
+}
+
+#if ENABLE_PERCPU_CACHE
+static void cpu_caches_flush(global_state *g);
+#endif
+
+/*
+ * Return to the system chunks all of whose pieces are free in the depot.
+ * Idle workers call this between Cilkified regions.  Other workers may
+ * allocate and free concurrently: the trimmer owns every magazine it takes
+ * from the depot, so a chunk whose carved bytes are all in those magazines
+ * has no piece anyone else can reach.
+ */
+void cilk_internal_malloc_trim(global_state *g) {
+    if (depot_free_bytes(g) < INTERNAL_MALLOC_CHUNK_SIZE)
+        return;
+    if (!cilk_mutex_try(&g->im_lock))
+        return;
+#if ENABLE_PERCPU_CACHE
+    cpu_caches_flush(g);
+#endif
+
+    // Chunks can only be released once every span has been taken and
+    // closed, after which their counters no longer change.
+    struct global_im_pool *im_pool = &g->im_pool;
+    unsigned int num_chunks = im_pool->mem_list_index + 1;
+    unsigned int candidates = 0;
+    for (unsigned int i = 0; i < num_chunks; ++i) {
+        struct im_chunk *chunk = im_pool->mem_list[i];
+        uint32_t spans =
+            atomic_load_explicit(&chunk->spans, memory_order_acquire);
+        chunk->held = 0;
+        chunk->releasing = chunk->mem && !(spans & CHUNK_SPAN_OPEN_MASK) &&
+                           spans / CHUNK_SPAN_TAKEN == chunk->size / IM_SPAN_SIZE;
+        candidates += chunk->releasing;
+    }
+    if (!candidates) {
+        cilk_mutex_unlock(&g->im_lock);
+        return;
+    }
+
+    // Take all full magazines, linking them through their next indices.
+    uint32_t taken[NUM_BUCKETS];
+    for (unsigned int i = 0; i < NUM_BUCKETS; ++i) {
+        struct im_magazine *m;
+        taken[i] = 0;
+        while ((m = depot_get_full(&g->im_depot[i]))) {
+            for (unsigned int k = 0; k < m->count; ++k) {
+                struct im_chunk *chunk = span_of(m->rounds[k])->chunk;
+                if (chunk->releasing)
+                    chunk->held += bucket_sizes[i];
+            }
+            atomic_store_explicit(&m->next, taken[i], memory_order_relaxed);
+            taken[i] = m->index;
+        }
+    }
+    for (unsigned int i = 0; i < num_chunks; ++i) {
+        struct im_chunk *chunk = im_pool->mem_list[i];
+        if (!chunk->releasing)
+            continue;
+        size_t carved =
+            atomic_load_explicit(&chunk->carved, memory_order_relaxed);
+        CILK_ASSERT(chunk->held <= carved);
+        chunk->releasing = chunk->held == carved;
+    }
+
+    // Give back the magazines without the pieces of released chunks.
+    for (unsigned int i = 0; i < NUM_BUCKETS; ++i) {
+        struct im_depot *depot = &g->im_depot[i];
+        uint32_t index = taken[i];
+        while (index) {
+            struct im_magazine *m = depot_magazine(depot, index);
+            index = atomic_load_explicit(&m->next, memory_order_relaxed);
+            unsigned int count = 0;
+            for (unsigned int k = 0; k < m->count; ++k)
+                if (!span_of(m->rounds[k])->chunk->releasing)
+                    m->rounds[count++] = m->rounds[k];
+            m->count = count;
+            if (count)
+                depot_put_full(depot, m);
+            else
+                depot_put_empty(depot, m);
+        }
+    }
+
+    for (unsigned int i = 0; i < num_chunks; ++i) {
+        struct im_chunk *chunk = im_pool->mem_list[i];
+        if (!chunk->releasing)
+            continue;
+        size_t carved =
+            atomic_load_explicit(&chunk->carved, memory_order_relaxed);
+        size_t wasted =
+            atomic_load_explicit(&chunk->wasted, memory_order_relaxed);
+        CILK_ASSERT(carved + wasted == chunk->size);
+        im_chunk_map_set(g, chunk->mem, chunk->size, false);
+        munmap(chunk->mem, chunk->size);
+        chunk->mem = NULL;
+        chunk->releasing = false;
+        im_pool->allocated -= chunk->size;
+        im_pool->released += chunk->size;
+        atomic_fetch_sub_explicit(&im_pool->carved, carved,
+                                  memory_order_relaxed);
+        atomic_fetch_sub_explicit(&im_pool->wasted, wasted,
+                                  memory_order_relaxed);
     }
+    cilk_mutex_unlock(&g->im_lock);
 }
 
 //=========================================================
@@ -432,52 +1113,89 @@ void cilk_internal_malloc_global_destroy(global_state *g) {
 //=========================================================
 
 /**
- * Allocate a batch of memory of size 'size' from global im bucket 'bucket'
- * into per-worker im bucket 'bucket'.
+ * Refill per-worker im bucket 'bucket', both of whose magazines are empty,
+ * with a full magazine from the depot or, failing that, from the global pool.
  */
 static void im_allocate_batch(__cilkrts_worker *w, size_t size,
                               unsigned int bucket_index) {
     global_state *g = w->g;
     local_state *l = w->l;
+    struct im_depot *depot = &g->im_depot[bucket_index];
     struct im_bucket *bucket = &l->im_desc.buckets[bucket_index];
-    unsigned int batch_size = bucket_capacity[bucket_index] / 2;
-    cilk_mutex_lock(&(g->im_lock));
-    for (unsigned int i = 0; i < batch_size; i++) {
-        void *p = global_im_alloc(w, size, bucket_index);
-        add_to_free_list(bucket, p);
+    struct im_magazine *full = depot_get_full(depot);
+    if (!full) {
+        full = bucket->previous;
+        global_im_alloc(w, size, bucket_index, full);
+    } else {
+        depot_put_empty(depot, bucket->previous);
     }
-    cilk_mutex_unlock(&(g->im_lock));
-    bucket->allocated += batch_size;
+    bucket->previous = bucket->loaded;
+    bucket->loaded = full;
+    bucket->free_list_size += full->count;
+    bucket->allocated += full->count;
     if (bucket->allocated > bucket->max_allocated) {
         bucket->max_allocated = bucket->allocated;
     }
 }
 
 /**
- * Free a batch of memory of size 'size' from per-worker im bucket 'bucket'
- * back to global im bucket 'bucket'.
+ * Move the full previous magazine of per-worker im bucket 'bucket' to the
+ * depot, replacing it with an empty one.
  */
-static void im_free_batch(__cilkrts_worker *w, size_t size,
-                          unsigned int which_bucket) {
+static void im_free_batch(__cilkrts_worker *w, unsigned int which_bucket) {
     global_state *g = w->g;
     local_state *l = w->l;
-    unsigned int batch_size = bucket_capacity[which_bucket] / 2;
+    struct im_depot *depot = &g->im_depot[which_bucket];
     struct im_bucket *bucket = &(l->im_desc.buckets[which_bucket]);
-    cilk_mutex_lock(&(g->im_lock));
-    for (unsigned int i = 0; i < batch_size; ++i) {
-        void *mem = remove_from_free_list(bucket);
-        if (!mem)
-            break;
-        add_to_free_list(&g->im_desc.buckets[which_bucket], mem);
-        g->im_desc.used -= size;
-        --bucket->allocated;
+    struct im_magazine *full = bucket->previous;
+    bucket->free_list_size -= full->count;
+    bucket->allocated -= full->count;
+    depot_put_full(depot, full);
+    bucket->previous = depot_get_empty(g, depot);
+}
+
+/* Remote queue heads of a terminated worker hold this value. */
+#define REMOTE_CLOSED ((void *)1)
+
+/* Push p onto the owner's remote queue for bucket 'which_bucket'.  Returns
+   false if the owner has terminated. */
+static bool remote_free(global_state *g, uint32_t owner,
+                        unsigned int which_bucket, void *p) {
+    void *_Atomic *head = &g->im_remote[owner].head[which_bucket];
+    void *old = atomic_load_explicit(head, memory_order_relaxed);
+    do {
+        if (old == REMOTE_CLOSED)
+            return false;
+        ((struct free_block *)p)->next = old;
+    } while (!atomic_compare_exchange_weak_explicit(
+        head, &old, p, memory_order_release, memory_order_relaxed));
+    return true;
+}
+
+/* Move the blocks in this worker's remote queue for bucket 'which_bucket'
+   into its magazines.  Returns the number of blocks moved. */
+static unsigned int im_drain_remote(__cilkrts_worker *w,
+                                    unsigned int which_bucket, void *close) {
+    void *_Atomic *head = &w->g->im_remote[w->self].head[which_bucket];
+    if (!close && !atomic_load_explicit(head, memory_order_relaxed))
+        return 0;
+    void *p = atomic_exchange_explicit(head, close, memory_order_acquire);
+    struct im_bucket *bucket = &w->l->im_desc.buckets[which_bucket];
+    unsigned int n = 0;
+    while (p) {
+        void *next = ((struct free_block *)p)->next;
+        if (bucket->free_list_size == bucket->free_list_limit)
+            im_free_batch(w, which_bucket);
+        add_to_free_list(bucket, p);
+        p = next;
+        ++n;
     }
-    cilk_mutex_unlock(&(w->g->im_lock));
-    /* Account for bytes allocated change? */
+    w->l->im_desc.remote_received += (long)n * bucket_to_size(which_bucket);
+    return n;
 }
 
 /*
- * Malloc returns a piece of memory at the head of the free list;
+ * Malloc returns a piece of memory from the loaded magazine;
  * last-in-first-out
  */
 CHEETAH_INTERNAL
@@ -485,7 +1203,7 @@ void *cilk_internal_malloc(__cilkrts_worker *w, size_t size, enum im_tag tag) {
     local_state *l = w->l;
     unsigned int which_bucket = size_to_bucket(size);
     if (which_bucket >= NUM_BUCKETS) {
-        return malloc_from_system(w, size);
+        return malloc_from_system(w->g, size);
     }
     if (ALERT_ENABLED(MEMORY))
         fprintf(stderr, "[W%d] alloc %zu tag %d\n", w->self, size, (int)tag);
@@ -498,8 +1216,9 @@ void *cilk_internal_malloc(__cilkrts_worker *w, size_t size, enum im_tag tag) {
     bucket->wasted += csize - size;
     void *mem = remove_from_free_list(bucket);
 
-    if (!mem) { // when out of memory, allocate a batch from global pool
-        im_allocate_batch(w, csize, which_bucket);
+    if (!mem) { // when out of memory, take back remote frees or refill
+        if (!im_drain_remote(w, which_bucket, NULL))
+            im_allocate_batch(w, csize, which_bucket);
         mem = remove_from_free_list(bucket);
         CILK_ASSERT(mem);
     }
@@ -513,7 +1232,7 @@ void *cilk_internal_malloc(__cilkrts_worker *w, size_t size, enum im_tag tag) {
 }
 
 /*
- * Free simply returns to the free list; last-in-first-out
+ * Free simply returns to the loaded magazine; last-in-first-out
  */
 void cilk_internal_free(__cilkrts_worker *w, void *p, size_t size,
                         enum im_tag tag) {
@@ -529,16 +1248,22 @@ void cilk_internal_free(__cilkrts_worker *w, void *p, size_t size,
     l->im_desc.num_malloc[tag] -= 1;
 
     unsigned int which_bucket = size_to_bucket(size);
-    CILK_ASSERT(which_bucket >= 0 && which_bucket < NUM_BUCKETS);
+    CILK_ASSERT(which_bucket < NUM_BUCKETS);
     unsigned int csize = bucket_to_size(which_bucket); // canonicalize the size
     struct im_bucket *bucket = &(l->im_desc.buckets[which_bucket]);
     bucket->wasted -= csize - size;
 
+    uint32_t owner = span_of(p)->owner;
+    if (owner != w->self && owner != IM_NO_OWNER &&
+        remote_free(w->g, owner, which_bucket, p)) {
+        l->im_desc.remote_sent += csize;
+        return;
+    }
+    if (bucket->free_list_size == bucket->free_list_limit) {
+        im_free_batch(w, which_bucket);
+    }
     add_to_free_list(bucket, p);
 
-    while (bucket->free_list_size > bucket->free_list_limit) {
-        im_free_batch(w, csize, which_bucket);
-    }
     if (ALERT_ENABLED(MEMORY))
         dump_memory_state(NULL, w->g);
 #if 0 /* not safe with multiple workers */
@@ -547,18 +1272,233 @@ void cilk_internal_free(__cilkrts_worker *w, void *p, size_t size,
 #endif
 }
 
+//=========================================================
+// Allocation outside of workers
+//=========================================================
+
+/* Carve a whole span into full magazines for the depot of bucket
+   'which_bucket'.  Pieces of the span have no owner. */
+static void depot_refill(global_state *g, unsigned int which_bucket) {
+    struct im_depot *depot = &g->im_depot[which_bucket];
+    size_t size = bucket_to_size(which_bucket);
+    char *span = global_im_alloc_span(g);
+    struct im_span *header = (struct im_span *)span;
+    header->owner = IM_NO_OWNER;
+    header->bucket = which_bucket;
+    char *begin = (char *)round_size_to_alignment(
+        bucket_to_alignment(which_bucket),
+        (uintptr_t)span + sizeof(struct im_span));
+    char *end = span + IM_SPAN_SIZE;
+    span_carved(g, header, 0, begin - span);
+    while (begin + size <= end) {
+        struct im_magazine *m = depot_get_empty(g, depot);
+        size_t n = (end - begin) / size;
+        if (n > m->capacity)
+            n = m->capacity;
+        for (size_t i = 0; i < n; ++i)
+            m->rounds[i] = begin + (n - 1 - i) * size;
+        m->count = n;
+        begin += n * size;
+        span_carved(g, header, n * size, 0);
+        depot_put_full(depot, m);
+    }
+    span_carved(g, header, 0, end - begin);
+    close_span(header);
+}
+
+#if ENABLE_PERCPU_CACHE
+/* Per-CPU caches serve only callers outside of workers, which otherwise
+   take every block from the shared depot.  Keying the worker buckets by CPU
+   as well would put an atomic claim, or an architecture-specific rseq
+   commit sequence, on the fast path of every worker allocation to save a
+   migrating worker some cache misses. */
+
+/* The CPU the calling thread runs on.  The kernel keeps cpu_id of the
+   thread's rseq area current, so reading it costs a load instead of a
+   system call.  The thread may migrate right after, which only costs
+   locality: the cache's busy flag keeps its magazines consistent. */
+static inline unsigned int current_cpu(void) {
+#ifdef HAVE_RSEQ
+    if (__rseq_size) {
+        struct rseq *rs =
+            (struct rseq *)((char *)__builtin_thread_pointer() +
+                            __rseq_offset);
+        int cpu = (int)__atomic_load_n(&rs->cpu_id, __ATOMIC_RELAXED);
+        if (cpu >= 0)
+            return cpu;
+    }
+#endif
+    int cpu = sched_getcpu();
+    return cpu < 0 ? 0 : cpu;
+}
+
+static struct im_cpu_cache *cpu_cache_acquire(global_state *g) {
+    struct im_cpu_cache *c = &g->im_cpu_cache[current_cpu() % g->im_num_cpus];
+    if (atomic_load_explicit(&c->busy, memory_order_relaxed) ||
+        atomic_exchange_explicit(&c->busy, true, memory_order_acquire))
+        return NULL;
+    return c;
+}
+
+static inline void cpu_cache_release(struct im_cpu_cache *c) {
+    atomic_store_explicit(&c->busy, false, memory_order_release);
+}
+
+static void *cpu_cache_malloc(global_state *g, struct im_cpu_cache *c,
+                              unsigned int which_bucket) {
+    struct im_depot *depot = &g->im_depot[which_bucket];
+    struct im_magazine *m = c->loaded[which_bucket];
+    if (!m || m->count == 0) {
+        struct im_magazine *full;
+        while (!(full = depot_get_full(depot)))
+            depot_refill(g, which_bucket);
+        if (m)
+            depot_put_empty(depot, m);
+        c->loaded[which_bucket] = m = full;
+    }
+    return m->rounds[--m->count];
+}
+
+static void cpu_cache_free(global_state *g, struct im_cpu_cache *c, void *p,
+                           unsigned int which_bucket) {
+    struct im_depot *depot = &g->im_depot[which_bucket];
+    struct im_magazine *m = c->loaded[which_bucket];
+    if (!m || m->count == m->capacity) {
+        struct im_magazine *empty = depot_get_empty(g, depot);
+        if (m)
+            depot_put_full(depot, m);
+        c->loaded[which_bucket] = m = empty;
+    }
+    m->rounds[m->count++] = p;
+}
+
+/* Give the magazines of every idle per-CPU cache back to the depot. */
+static void cpu_caches_flush(global_state *g) {
+    for (unsigned int i = 0; i < g->im_num_cpus; ++i) {
+        struct im_cpu_cache *c = &g->im_cpu_cache[i];
+        if (atomic_exchange_explicit(&c->busy, true, memory_order_acquire))
+            continue;
+        for (unsigned int j = 0; j < NUM_BUCKETS; ++j) {
+            struct im_magazine *m = c->loaded[j];
+            if (!m)
+                continue;
+            c->loaded[j] = NULL;
+            if (m->count)
+                depot_put_full(&g->im_depot[j], m);
+            else
+                depot_put_empty(&g->im_depot[j], m);
+        }
+        cpu_cache_release(c);
+    }
+}
+#endif // ENABLE_PERCPU_CACHE
+
+/* Allocate a block of bucket 'which_bucket' straight from the depot, or
+   from the cache of the current CPU if there is one.  This is slower than
+   allocating from a worker's magazines, but safe from any thread. */
+static void *im_outside_malloc(global_state *g, unsigned int which_bucket) {
+    struct im_depot *depot = &g->im_depot[which_bucket];
+#if ENABLE_PERCPU_CACHE
+    struct im_cpu_cache *c = cpu_cache_acquire(g);
+    if (c) {
+        void *p = cpu_cache_malloc(g, c, which_bucket);
+        cpu_cache_release(c);
+        atomic_fetch_add_explicit(&depot->outside, 1, memory_order_relaxed);
+        return p;
+    }
+#endif
+    struct im_magazine *m;
+    while (!(m = depot_get_full(depot)))
+        depot_refill(g, which_bucket);
+    void *p = m->rounds[--m->count];
+    if (m->count)
+        depot_put_full(depot, m);
+    else
+        depot_put_empty(depot, m);
+    atomic_fetch_add_explicit(&depot->outside, 1, memory_order_relaxed);
+    return p;
+}
+
+static void im_outside_free(global_state *g, void *p,
+                            unsigned int which_bucket) {
+    struct im_depot *depot = &g->im_depot[which_bucket];
+#if ENABLE_PERCPU_CACHE
+    struct im_cpu_cache *c = cpu_cache_acquire(g);
+    if (c) {
+        cpu_cache_free(g, c, p, which_bucket);
+        cpu_cache_release(c);
+    } else {
+        depot_put_block(g, depot, p);
+    }
+#else
+    depot_put_block(g, depot, p);
+#endif
+    atomic_fetch_sub_explicit(&depot->outside, 1, memory_order_relaxed);
+}
+
 /* This function is called after workers have terminated.
    It has no locking. */
 void cilk_internal_free_global(global_state *g, void *p, size_t size,
                                enum im_tag tag) {
-    unsigned int which_bucket = size_to_bucket(size);
-    add_to_free_list(&g->im_desc.buckets[which_bucket], p);
-    g->im_desc.num_malloc[tag]--;
-    g->im_desc.used -= bucket_to_size(which_bucket);
+    im_outside_free(g, p, size_to_bucket(size));
+    g->im_num_malloc[tag]--;
+}
+
+//=========================================================
+// Public allocator
+//=========================================================
+
+/* The worker running the caller, or NULL if the caller is not Cilk code.
+   __cilkrts_need_to_cilkify is shared by all threads, so it only tells that
+   some region is running, and the TLS worker of every thread starts out as
+   worker 0.  Only Cilk code runs on a fiber, which knows its worker. */
+static inline __cilkrts_worker *cilk_code_worker(void) {
+    struct cilk_fiber *fh = __cilkrts_current_fh;
+    return fh && !__cilkrts_need_to_cilkify ? fh->worker : NULL;
+}
+
+/* Cilk workers use their own magazines.  Other callers, including other
+   threads while a region runs and the thread that runs Cilkified regions
+   when it is outside of one, use the depot.  Large blocks, and blocks
+   allocated before the runtime starts or after it shuts down, come from
+   malloc. */
+void *cilk_malloc(size_t size) {
+    global_state *g = default_cilkrts;
+    if (__builtin_expect(!g, false) || size > SIZE_THRESH)
+        return malloc(size);
+    __cilkrts_worker *w = cilk_code_worker();
+    if (w)
+        return cilk_internal_malloc(w, size, IM_USER);
+    atomic_fetch_add_explicit(&g->im_num_user_outside, 1,
+                              memory_order_relaxed);
+    return im_outside_malloc(g, size_to_bucket(size));
+}
+
+/* Whether a block came from the pool depends on when it was allocated, not
+   when it is freed, so ask the map of the pool's chunks.  Blocks of the pool
+   freed after the runtime shut down went away with it. */
+void cilk_free(void *ptr, size_t size) {
+    if (!ptr)
+        return;
+    if (size > SIZE_THRESH || !im_pool_owns(ptr)) {
+        free(ptr);
+        return;
+    }
+    global_state *g = default_cilkrts;
+    if (__builtin_expect(!g, false))
+        return;
+    __cilkrts_worker *w = cilk_code_worker();
+    if (w) {
+        cilk_internal_free(w, ptr, size, IM_USER);
+        return;
+    }
+    atomic_fetch_sub_explicit(&g->im_num_user_outside, 1,
+                              memory_order_relaxed);
+    im_outside_free(g, ptr, size_to_bucket(size));
 }
 
 void cilk_internal_malloc_per_worker_init(__cilkrts_worker *w) {
-    init_im_buckets(&(w->l->im_desc));
+    init_im_buckets(w->g, &(w->l->im_desc));
 }
 
 void cilk_internal_malloc_per_worker_terminate(__cilkrts_worker *w) {
@@ -568,12 +1508,31 @@ void cilk_internal_malloc_per_worker_terminate(__cilkrts_worker *w) {
     if (DEBUG_ENABLED(MEMORY_SLOW))
         internal_malloc_global_check(g);
     for (unsigned int i = 0; i < NUM_BUCKETS; i++) {
-        assert_bucket(&l->im_desc.buckets[i]);
-        while (l->im_desc.buckets[i].free_list)
-            im_free_batch(w, bucket_to_size(i), i);
+        struct im_bucket *bucket = &l->im_desc.buckets[i];
+        // Later frees of this worker's blocks stay with the freeing worker.
+        im_drain_remote(w, i, REMOTE_CLOSED);
+        struct im_magazine *mags[2] = {bucket->loaded, bucket->previous};
+        assert_bucket(bucket);
+        bucket->loaded = bucket->previous = NULL;
+        if (bucket->span) {
+            span_carved(g, bucket->span, 0,
+                        bucket->span_end - bucket->span_begin);
+            close_span(bucket->span);
+            bucket->span = NULL;
+        }
+        bucket->span_begin = bucket->span_end = NULL;
+        for (int j = 0; j < 2; ++j) {
+            if (mags[j]->count) {
+                bucket->free_list_size -= mags[j]->count;
+                bucket->allocated -= mags[j]->count;
+                depot_put_full(&g->im_depot[i], mags[j]);
+            } else {
+                depot_put_empty(&g->im_depot[i], mags[j]);
+            }
+        }
     }
     for (int i = 0; i < IM_NUM_TAGS; ++i) {
-        g->im_desc.num_malloc[i] += l->im_desc.num_malloc[i];
+        g->im_num_malloc[i] += l->im_desc.num_malloc[i];
         l->im_desc.num_malloc[i] = 0;
     }
     if (ALERT_ENABLED(MEMORY))
@@ -591,7 +1550,7 @@ void cilk_internal_malloc_per_worker_destroy(__cilkrts_worker *w) {
     (void)l;
     for (unsigned int i = 0; i < NUM_BUCKETS; i++) {
         CILK_ASSERT_INDEX_ZERO(l->im_desc.buckets, i, .free_list_size, "%u");
-        CILK_ASSERT_INDEX_ZERO(l->im_desc.buckets, i, .free_list, "%p");
+        CILK_ASSERT_INDEX_ZERO(l->im_desc.buckets, i, .loaded, "%p");
         /* allocated may be nonzero due to memory migration */
     }
 #endif
@@ -607,6 +1566,8 @@ const char *name_for_im_tag(enum im_tag tag) {
         return "fiber";
     case IM_REDUCER_MAP:
         return "reducer map";
+    case IM_USER:
+        return "user";
     default:
         return "unknown";
     }
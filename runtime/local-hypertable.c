@@ -1,23 +1,54 @@
 #include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <fcntl.h>
+#endif
 
 #include "cilk-internal.h"
 #include "debug.h"
 #include "internal-malloc.h" /* only needed for new view allocation */
 #include "local-hypertable.h"
 
+#if ENABLE_HYPERTABLE_SIMD && defined __AVX2__
+#include <immintrin.h>
+#define PROBE_WIDTH 8
+#elif ENABLE_HYPERTABLE_SIMD && defined __SSE2__
+#include <emmintrin.h>
+#define PROBE_WIDTH 4
+#else
+#define PROBE_WIDTH 1
+#endif
+
 static void reducer_base_init(reducer_base *rb) {
     rb->view = NULL;
     rb->reduce_fn = NULL;
+    rb->slab = NULL;
 }
 
 static void make_tombstone(uintptr_t *key) { *key = KEY_DELETED; }
 
-static void bucket_init(struct bucket *b) {
-    b->key = KEY_EMPTY;
-    reducer_base_init(&b->value);
+static void entry_init(hyper_table *table, index_t i) {
+    table->keys[i] = KEY_EMPTY;
+    table->hashes[i] = empty_hash(i);
+    reducer_base_init(&table->values[i]);
+}
+
+static inline struct bucket get_entry(const hyper_table *table, index_t i) {
+    return (struct bucket){.key = table->keys[i],
+                           .hash = table->hashes[i],
+                           .value = table->values[i]};
+}
+
+static inline void set_entry(hyper_table *table, index_t i, struct bucket b) {
+    table->keys[i] = b.key;
+    table->hashes[i] = b.hash;
+    table->values[i] = b.value;
 }
 
 // Constant used to determine the target maximum load factor.  The
@@ -49,53 +80,82 @@ static bool time_to_rebuild(int32_t ins_rm_count, int32_t capacity) {
            (ins_rm_count > capacity / (4 * LOAD_FACTOR_CONSTANT));
 }
 
-static struct bucket *bucket_array_create(int32_t array_size) {
-    struct bucket *buckets =
-        (struct bucket *)calloc(array_size, sizeof(struct bucket));
+// Allocate and initialize the entry arrays of table for the given capacity.
+// The values come right after the keys and the hashes last, which keeps every
+// array aligned for any capacity.
+static void entry_arrays_create(hyper_table *table, int32_t array_size) {
+    uintptr_t *keys = (uintptr_t *)hyper_table_mem_alloc(
+        hyper_table_entries_size(array_size), table->pooled);
+    table->keys = keys;
+    table->values = (reducer_base *)(keys + array_size);
+    table->hashes = (index_t *)(table->values + array_size);
     if (array_size < MIN_HT_CAPACITY) {
         for (int32_t i = 0; i < array_size; ++i) {
-            bucket_init(&buckets[i]);
+            entry_init(table, i);
         }
-        return buckets;
+        return;
     }
     int32_t tombstone_idx = 0;
     for (int32_t i = 0; i < array_size; ++i) {
-        bucket_init(&buckets[i]);
+        entry_init(table, i);
         // Graveyard hashing: Insert tombstones at regular intervals.
         // TODO: Check if it's bad for the insertions to rebuild a
         // table to use these tombstones.
         if (tombstone_idx == 2 * LOAD_FACTOR_CONSTANT) {
-            make_tombstone(&buckets[i].key);
+            make_tombstone(&keys[i]);
+            table->hashes[i] = tombstone_hash(i);
             tombstone_idx -= 2 * LOAD_FACTOR_CONSTANT;
         } else
             ++tombstone_idx;
     }
-    return buckets;
 }
 
-hyper_table *__cilkrts_local_hyper_table_alloc(void) {
-    hyper_table *table = malloc(sizeof(hyper_table));
-    int32_t capacity = MIN_CAPACITY;
+// Allocate an empty table with the given capacity, a power of 2, to avoid
+// rebuilding a table expected to hold many reducers as it fills.
+hyper_table *local_hyper_table_alloc(int32_t capacity) {
+    assert(capacity >= MIN_CAPACITY && capacity <= MAX_CAPACITY &&
+           (capacity & (capacity - 1)) == 0);
+    bool pooled = hyper_table_mem_pooled();
+    hyper_table *table = hyper_table_mem_alloc(sizeof(hyper_table), pooled);
     table->capacity = capacity;
     table->occupancy = 0;
     table->ins_rm_count = 0;
-    table->buckets = bucket_array_create(capacity);
+    table->commutative = 0;
+    table->pooled = pooled;
+    table->view_slab = NULL;
+    table->deferred = NULL;
+    for (int i = 0; i < LOOKUP_CACHE_SIZE; ++i)
+        table->cache[i].key = KEY_EMPTY;
+    entry_arrays_create(table, capacity);
     return table;
 }
 
+hyper_table *__cilkrts_local_hyper_table_alloc(void) {
+    return local_hyper_table_alloc(MIN_CAPACITY);
+}
+
+static void view_slab_release(struct view_slab *slab);
+
 void local_hyper_table_free(hyper_table *table) {
-    free(table->buckets);
-    free(table);
+    assert(!table->deferred && "Freeing table with deferred reductions.");
+    if (table->view_slab)
+        view_slab_release(table->view_slab);
+    hyper_table_mem_free(table->keys,
+                         hyper_table_entries_size(table->capacity),
+                         table->pooled);
+    hyper_table_mem_free(table, sizeof(hyper_table), table->pooled);
 }
 
-static struct bucket *rebuild_table(hyper_table *table, int32_t new_capacity) {
-    struct bucket *old_buckets = table->buckets;
+static bool insert_entry(hyper_table *table, struct bucket b);
+
+static void rebuild_table(hyper_table *table, int32_t new_capacity) {
+    hyper_table old = *table;
     int32_t old_capacity = table->capacity;
     int32_t old_occupancy = table->occupancy;
 
     assert(new_capacity <= MAX_CAPACITY);
 
-    table->buckets = bucket_array_create(new_capacity);
+    entry_arrays_create(table, new_capacity);
     table->capacity = new_capacity;
     table->occupancy = 0;
     // Set count of insertions and removals to prevent insertions into
@@ -105,8 +165,8 @@ static struct bucket *rebuild_table(hyper_table *table, int32_t new_capacity) {
     // Iterate through old table and insert each element into the new
     // table.
     for (int32_t i = 0; i < old_capacity; ++i) {
-        if (is_valid(old_buckets[i].key)) {
-            bool success = insert_hyperobject(table, old_buckets[i]);
+        if (is_valid(old.keys[i])) {
+            bool success = insert_entry(table, get_entry(&old, i));
             assert(success && "Failed to insert when resizing table.");
             (void)success;
         }
@@ -115,71 +175,190 @@ static struct bucket *rebuild_table(hyper_table *table, int32_t new_capacity) {
     assert(table->occupancy == old_occupancy &&
            "Mismatched occupancy after resizing table.");
 
-    free(old_buckets);
-    return table->buckets;
+    hyper_table_mem_free(old.keys, hyper_table_entries_size(old_capacity),
+                         table->pooled);
 }
 
 ///////////////////////////////////////////////////////////////////////////
 // Query, insert, and delete methods for the hash table.
 
-struct bucket *__cilkrts_find_hyperobject_hash(hyper_table *table,
-                                               uintptr_t key) {
-    int32_t capacity = table->capacity;
+#if PROBE_WIDTH == 8
+// AVX2: compare 4 keys or 8 hashes per instruction.
+typedef __m256i key_vec;
+#define KEY_LANES 4
+
+static inline key_vec key_splat(uintptr_t key) {
+    return _mm256_set1_epi64x((long long)key);
+}
+
+static inline key_vec key_load(const uintptr_t *keys) {
+    return _mm256_loadu_si256((const __m256i *)keys);
+}
+
+// Mask of the lanes of a and b that are equal.
+static inline unsigned key_eq_mask(key_vec a, key_vec b) {
+    return _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(a, b)));
+}
+
+// Mask of the PROBE_WIDTH entries starting at index i whose hash ends a
+// probe for tgt, i.e., !continue_probe(tgt, hash, idx).
+static inline unsigned hash_stop_mask(const index_t *hashes, index_t tgt,
+                                      index_t i) {
+    // Bias both sides to compare unsigned integers with a signed compare.
+    const __m256i bias = _mm256_set1_epi32(INT32_MIN);
+    __m256i idx = _mm256_add_epi32(_mm256_set1_epi32(i),
+                                   _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    __m256i h = _mm256_loadu_si256((const __m256i *)hashes);
+    __m256i dist_tgt =
+        _mm256_xor_si256(_mm256_sub_epi32(idx, _mm256_set1_epi32(tgt)), bias);
+    __m256i dist_hash = _mm256_xor_si256(_mm256_sub_epi32(idx, h), bias);
+    return _mm256_movemask_ps(
+        _mm256_castsi256_ps(_mm256_cmpgt_epi32(dist_tgt, dist_hash)));
+}
+#elif PROBE_WIDTH == 4
+// SSE2: compare 2 keys or 4 hashes per instruction.
+typedef __m128i key_vec;
+#define KEY_LANES 2
+
+static inline key_vec key_splat(uintptr_t key) {
+    return _mm_set1_epi64x((long long)key);
+}
+
+static inline key_vec key_load(const uintptr_t *keys) {
+    return _mm_loadu_si128((const __m128i *)keys);
+}
+
+// Mask of the lanes of a and b that are equal.  SSE2 has no 64-bit compare,
+// so combine the compares of the two halves of each key.
+static inline unsigned key_eq_mask(key_vec a, key_vec b) {
+    __m128i eq = _mm_cmpeq_epi32(a, b);
+    eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_movemask_pd(_mm_castsi128_pd(eq));
+}
+
+// Mask of the PROBE_WIDTH entries starting at index i whose hash ends a
+// probe for tgt, i.e., !continue_probe(tgt, hash, idx).
+static inline unsigned hash_stop_mask(const index_t *hashes, index_t tgt,
+                                      index_t i) {
+    // Bias both sides to compare unsigned integers with a signed compare.
+    const __m128i bias = _mm_set1_epi32(INT32_MIN);
+    __m128i idx =
+        _mm_add_epi32(_mm_set1_epi32(i), _mm_setr_epi32(0, 1, 2, 3));
+    __m128i h = _mm_loadu_si128((const __m128i *)hashes);
+    __m128i dist_tgt =
+        _mm_xor_si128(_mm_sub_epi32(idx, _mm_set1_epi32(tgt)), bias);
+    __m128i dist_hash = _mm_xor_si128(_mm_sub_epi32(idx, h), bias);
+    return _mm_movemask_ps(
+        _mm_castsi128_ps(_mm_cmpgt_epi32(dist_tgt, dist_hash)));
+}
+#endif
+
+#if PROBE_WIDTH > 1
+// Examine the PROBE_WIDTH entries of table starting at index i, which must
+// not wrap around the end of the table, in a probe for key with target hash
+// tgt.  Returns the mask of the entries at which the scalar probe would stop
+// and sets *found to the mask of the entries holding key.  The lowest bit set
+// in the result tells how the probe ends.  Since the hashes of empty entries
+// and tombstones encode whether they stop the probe, only the hashes need to
+// be compared besides the keys.
+static inline unsigned probe_group(const hyper_table *table, uintptr_t key,
+                                   index_t tgt, index_t i, unsigned *found) {
+    const key_vec k = key_splat(key);
+    unsigned match = 0;
+    for (int j = 0; j < PROBE_WIDTH; j += KEY_LANES)
+        match |= key_eq_mask(key_load(table->keys + i + j), k) << j;
+    *found = match;
+    return match | hash_stop_mask(table->hashes + i, tgt, i);
+}
+#endif
+
+reducer_base *__cilkrts_find_hyperobject_hash(hyper_table *table,
+                                              uintptr_t key) {
+    index_t capacity = table->capacity;
 
     // Target hash
     const index_t tgt = get_table_entry(capacity, key);
-    struct bucket *buckets = table->buckets;
+    const uintptr_t *keys = table->keys;
+    // Most probes end at the target entry itself.  Check it before setting
+    // up the vectors, which also takes care of an empty target entry, whose
+    // hash does not stop the probe.
+    if (keys[tgt] == key)
+        return &table->values[tgt];
+    if (is_empty(keys[tgt]))
+        return NULL;
     // Start the probe at the target hash
     index_t i = tgt;
+    // The probe fails once it has examined every entry.
+    index_t scanned = 0;
     do {
-        uintptr_t curr_key = buckets[i].key;
-        // Found the key?  Return that bucket.
-        // TODO: Consider moving this bucket to the front of the run.
+#if PROBE_WIDTH > 1
+        // Examine PROBE_WIDTH entries at once, unless they wrap around the
+        // end of the table.  Examining entries again after the probe wraps
+        // all the way around to tgt does not change its outcome.
+        if (capacity - i >= PROBE_WIDTH) {
+            unsigned found;
+            unsigned end = probe_group(table, key, tgt, i, &found);
+            if (end) {
+                unsigned lane = __builtin_ctz(end);
+                return (found >> lane) & 1 ? &table->values[i + lane] : NULL;
+            }
+            i += PROBE_WIDTH;
+            if (i == capacity)
+                i = 0;
+            scanned += PROBE_WIDTH;
+            continue;
+        }
+#endif
+        uintptr_t curr_key = keys[i];
+        // Found the key?  Return that entry.
+        // TODO: Consider moving this entry to the front of the run.
         if (key == curr_key)
-            return &buckets[i];
+            return &table->values[i];
 
         // Found an empty entry?  The probe failed.
         if (is_empty(curr_key))
             return NULL;
 
-        // Found a tombstone?  Continue the probe.
-        if (is_tombstone(curr_key)) {
-            i = inc_index(i, capacity);
-            continue;
-        }
-
-        // Otherwise, buckets[i] is another valid key that does not match.
-        index_t curr_hash = buckets[i].hash;
-
-        if (continue_probe(tgt, curr_hash, i)) {
-            i = inc_index(i, capacity);
-            continue;
-        }
+        // Found a tombstone?  Continue the probe.  Otherwise, keys[i] is
+        // another valid key that does not match.  Compare the hashes to
+        // decide whether or not to continue the probe.
+        if (!is_tombstone(curr_key) &&
+            !continue_probe(tgt, table->hashes[i], i))
+            return NULL;
 
-        // If none of the above cases match, then the probe failed to
-        // find the key.
-        return NULL;
-    } while (i != tgt);
+        i = inc_index(i, capacity);
+        ++scanned;
+    } while (scanned < capacity);
 
     // The probe failed to find the key.
     return NULL;
 }
 
+// Drop the lookup cache entry of key, whose view is going away or changing.
+static inline void lookup_cache_forget(hyper_table *table, uintptr_t key) {
+    struct lookup_cache_entry *e = lookup_cache_slot(table, key);
+    if (e->key == key)
+        e->key = KEY_EMPTY;
+}
+
 bool remove_hyperobject(hyper_table *table, uintptr_t key) {
+    lookup_cache_forget(table, key);
     if (table->capacity < MIN_HT_CAPACITY) {
         // If the table is small enough, just scan the array.
-        struct bucket *buckets = table->buckets;
+        uintptr_t *keys = table->keys;
         int32_t occupancy = table->occupancy;
 
         for (int32_t i = 0; i < occupancy; ++i) {
-            if (buckets[i].key == key) {
+            if (keys[i] == key) {
+                table->commutative -=
+                    is_commutative_reduce(table->values[i].reduce_fn);
                 if (i == occupancy - 1)
                     // Set this entry's key to empty.  This code is here
                     // primarily to handle the case where occupancy == 1.
-                    buckets[i].key = KEY_EMPTY;
+                    keys[i] = KEY_EMPTY;
                 else
                     // Remove this entry by swapping it with the last entry.
-                    buckets[i] = buckets[occupancy - 1];
+                    set_entry(table, i, get_entry(table, occupancy - 1));
                 // Decrement the occupancy.
                 --table->occupancy;
                 return true;
@@ -189,15 +368,18 @@ bool remove_hyperobject(hyper_table *table, uintptr_t key) {
     }
 
     // Find the key in the table.
-    struct bucket *entry = find_hyperobject(table, key);
+    reducer_base *entry = find_hyperobject(table, key);
 
     // If entry is NULL, the probe did not find the key.
     if (NULL == entry)
         return false;
 
-    // The probe found the key and returned a pointer to the entry.
+    // The probe found the key and returned a pointer to the entry's value.
     // Replace the entry with a tombstone and decrement the occupancy.
-    make_tombstone(&entry->key);
+    index_t idx = entry - table->values;
+    table->commutative -= is_commutative_reduce(entry->reduce_fn);
+    make_tombstone(&table->keys[idx]);
+    table->hashes[idx] = tombstone_hash(idx);
     --table->occupancy;
     ++table->ins_rm_count;
 
@@ -210,25 +392,35 @@ bool remove_hyperobject(hyper_table *table, uintptr_t key) {
     return true;
 }
 
-bool insert_hyperobject(hyper_table *table, struct bucket b) {
+// Replace the value of the entry at index i of table, which holds the key
+// being inserted.
+static void replace_value(hyper_table *table, index_t i, reducer_base value) {
+    lookup_cache_forget(table, table->keys[i]);
+    table->commutative += is_commutative_reduce(value.reduce_fn) -
+                          is_commutative_reduce(table->values[i].reduce_fn);
+    table->values[i] = value;
+}
+
+// Insert bucket b into table, without counting a new entry in
+// table->commutative.
+static bool insert_entry(hyper_table *table, struct bucket b) {
     assert(b.key != KEY_EMPTY && b.key != KEY_DELETED);
     int32_t capacity = table->capacity;
-    struct bucket *buckets = table->buckets;
     if (capacity < MIN_HT_CAPACITY) {
         // If the table is small enough, just scan the array.
         int32_t occupancy = table->occupancy;
 
         if (occupancy < capacity) {
             for (int32_t i = 0; i < occupancy; ++i) {
-                if (buckets[i].key == b.key) {
+                if (table->keys[i] == b.key) {
                     // The key is already in the table.  Overwrite.
-                    buckets[i] = b;
+                    replace_value(table, i, b.value);
                     return true;
                 }
             }
 
             // The key is not aleady in the table.  Append the bucket.
-            buckets[occupancy] = b;
+            set_entry(table, occupancy, b);
             ++table->occupancy;
             return true;
         }
@@ -237,24 +429,26 @@ bool insert_hyperobject(hyper_table *table, struct bucket b) {
         // to a hash table, and fall through to insert the new bucket
         // into that hash table.
         capacity *= 2;
-        buckets = rebuild_table(table, capacity);
+        rebuild_table(table, capacity);
     }
 
     // If the occupancy is already too high, rebuild the table.
     if (is_overloaded(table->occupancy, capacity)) {
         capacity *= 2;
-        buckets = rebuild_table(table, capacity);
+        rebuild_table(table, capacity);
     } else if (time_to_rebuild(table->ins_rm_count, capacity)) {
-        buckets = rebuild_table(table, capacity);
+        rebuild_table(table, capacity);
     }
+    uintptr_t *keys = table->keys;
+    index_t *hashes = table->hashes;
 
     // Target hash
     const index_t tgt = get_table_entry(capacity, b.key);
     b.hash = tgt;
 
     // If we find an empty entry, insert the bucket there.
-    if (is_empty(buckets[tgt].key)) {
-        buckets[tgt] = b;
+    if (is_empty(keys[tgt])) {
+        set_entry(table, tgt, b);
         ++table->occupancy;
         ++table->ins_rm_count;
         return true;
@@ -265,17 +459,17 @@ bool insert_hyperobject(hyper_table *table, struct bucket b) {
 
     const index_t probe_end = tgt;
     do {
-        uintptr_t curr_key = buckets[i].key;
+        uintptr_t curr_key = keys[i];
         // Found the key?  Overwrite that bucket.
         // TODO: Reconsider what to do in this case.
         if (b.key == curr_key) {
-            buckets[i].value = b.value;
+            replace_value(table, i, b.value);
             return true;
         }
 
         // Found an empty entry?  Insert b there.
         if (is_empty(curr_key)) {
-            buckets[i] = b;
+            set_entry(table, i, b);
             ++table->occupancy;
             ++table->ins_rm_count;
             return true;
@@ -286,16 +480,16 @@ bool insert_hyperobject(hyper_table *table, struct bucket b) {
             index_t current_tomb = i;
             // Scan consecutive tombstones from i.
             index_t next_i = inc_index(i, capacity);
-            uintptr_t tomb_end = buckets[next_i].key;
+            uintptr_t tomb_end = keys[next_i];
             while (next_i != probe_end && is_tombstone(tomb_end)) {
                 next_i = inc_index(next_i, capacity);
-                tomb_end = buckets[next_i].key;
+                tomb_end = keys[next_i];
             }
 
             // If the next entry is empty, then the probe would stop.  It's
             // safe to insert the bucket at the tombstone at i.
             if (is_empty(tomb_end)) {
-                buckets[current_tomb] = b;
+                set_entry(table, current_tomb, b);
                 ++table->occupancy;
                 ++table->ins_rm_count;
                 return true;
@@ -304,11 +498,11 @@ bool insert_hyperobject(hyper_table *table, struct bucket b) {
             // Check if the hash at the end of this run of tombstones would
             // terminate the probe or if the probe has traversed the whole
             // table.
-            index_t tomb_end_hash = buckets[next_i].hash;
+            index_t tomb_end_hash = hashes[next_i];
             if (next_i == probe_end ||
                 !continue_probe(tgt, tomb_end_hash, next_i)) {
                 // It's safe to insert b at the current tombstone.
-                buckets[current_tomb] = b;
+                set_entry(table, current_tomb, b);
                 ++table->occupancy;
                 ++table->ins_rm_count;
                 return true;
@@ -323,7 +517,7 @@ bool insert_hyperobject(hyper_table *table, struct bucket b) {
         // Otherwise this entry contains another valid key that does
         // not match.  Compare the hashes to decide whether or not to
         // continue the probe.
-        index_t curr_hash = buckets[i].hash;
+        index_t curr_hash = hashes[i];
         if (continue_probe(tgt, curr_hash, i)) {
             i = inc_index(i, capacity);
             continue;
@@ -340,16 +534,16 @@ bool insert_hyperobject(hyper_table *table, struct bucket b) {
     do {
         // If this entry is empty or a tombstone, insert the current bucket at
         // this location and terminate.
-        if (!is_valid(buckets[i].key)) {
-            buckets[i] = b;
+        if (!is_valid(keys[i])) {
+            set_entry(table, i, b);
             ++table->occupancy;
             ++table->ins_rm_count;
             return true;
         }
 
         // Swap b with the current bucket.
-        struct bucket tmp = buckets[i];
-        buckets[i] = b;
+        struct bucket tmp = get_entry(table, i);
+        set_entry(table, i, b);
         b = tmp;
 
         // Continue onto the next index.
@@ -360,23 +554,649 @@ bool insert_hyperobject(hyper_table *table, struct bucket b) {
     return false;
 }
 
+bool insert_hyperobject(hyper_table *table, struct bucket b) {
+    int32_t occupancy = table->occupancy;
+    bool success = insert_entry(table, b);
+    if (table->occupancy != occupancy)
+        table->commutative += is_commutative_reduce(b.value.reduce_fn);
+    return success;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Memory for views.
+
+// Views of at most SMALL_VIEW_SIZE bytes that a table with pooled memory
+// creates are carved out of slabs rather than allocated one by one.  A slab
+// is freed along with the last view carved out of it, so views never move.
+// Since the views carved out of a slab only ever belong to one table at a
+// time, namely the table the slab's table was merged into, the worker using
+// that table is the only one touching the slab.
+#define SMALL_VIEW_SIZE 32
+#define VIEW_SLAB_SIZE 256
+#define VIEW_SLAB_VIEWS ((VIEW_SLAB_SIZE - SMALL_VIEW_SIZE) / SMALL_VIEW_SIZE)
+
+struct view_slab {
+    // Number of views carved out of the slab and not yet freed, plus one
+    // while the slab is the view_slab of a table.
+    uint32_t live;
+    // Number of views carved out of the slab.  Freed views are not reused.
+    uint32_t used;
+    // A view no larger than SMALL_VIEW_SIZE has no stricter alignment.
+    _Alignas(SMALL_VIEW_SIZE) char views[VIEW_SLAB_VIEWS][SMALL_VIEW_SIZE];
+};
+
+_Static_assert(sizeof(struct view_slab) == VIEW_SLAB_SIZE,
+               "Unexpected view slab size");
+
+static void view_slab_release(struct view_slab *slab) {
+    if (--slab->live == 0)
+        hyper_table_mem_free(slab, sizeof(struct view_slab), true);
+}
+
+// Carve a small view out of the view slab of table, starting a new slab if
+// the current one is used up.
+static void *view_slab_alloc(hyper_table *table, struct view_slab **slabp) {
+    struct view_slab *slab = table->view_slab;
+    if (!slab || slab->used == VIEW_SLAB_VIEWS) {
+        if (slab)
+            view_slab_release(slab);
+        slab = hyper_table_mem_alloc(sizeof(struct view_slab), true);
+        slab->live = 1;
+        slab->used = 0;
+        table->view_slab = slab;
+    }
+    ++slab->live;
+    *slabp = slab;
+    return slab->views[slab->used++];
+}
+
+// Views of at least ZERO_PAGES_MIN_SIZE bytes whose identity function is
+// registered as zeroing them are mapped on fresh anonymous pages, which the
+// kernel zeroes when they are first touched, rather than allocated and
+// passed to the identity function.  Reducing such a view only visits the
+// pages that were touched.  The page before the view holds its header, and
+// the slab of its reducer_base is ZERO_PAGES_VIEW.
+#define ZERO_PAGES_MIN_SIZE (64 * 1024)
+#define MAX_ZERO_IDENTITIES 16
+#define ZERO_PAGES_VIEW ((struct view_slab *)1)
+
+struct zero_pages_header {
+    size_t size; // size of the view
+    __cilk_reduce_range_fn reduce_range;
+};
+
+static struct {
+    __cilk_identity_fn identity;
+    __cilk_reduce_range_fn reduce_range;
+} zero_identities[MAX_ZERO_IDENTITIES];
+static _Atomic int num_zero_identities = 0;
+
+// Serializes registrations, so that two cannot fill the same slot.  Lookups
+// take no lock; they see only the slots published by the count.
+static pthread_mutex_t registration_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int add_zero_identity(__cilk_identity_fn identity,
+                      __cilk_reduce_range_fn reduce_range) {
+    int ret = 0;
+    pthread_mutex_lock(&registration_lock);
+    int n = atomic_load_explicit(&num_zero_identities, memory_order_relaxed);
+    if (zero_identity_reduce(identity) == NULL) {
+        if (n == MAX_ZERO_IDENTITIES) {
+            ret = -1;
+        } else {
+            zero_identities[n].identity = identity;
+            zero_identities[n].reduce_range = reduce_range;
+            atomic_store_explicit(&num_zero_identities, n + 1,
+                                  memory_order_release);
+        }
+    }
+    pthread_mutex_unlock(&registration_lock);
+    return ret;
+}
+
+__cilk_reduce_range_fn zero_identity_reduce(__cilk_identity_fn identity) {
+    int n = atomic_load_explicit(&num_zero_identities, memory_order_acquire);
+    for (int i = 0; i < n; ++i) {
+        if (zero_identities[i].identity == identity)
+            return zero_identities[i].reduce_range;
+    }
+    return NULL;
+}
+
+static size_t page_size(void) {
+    static size_t size = 0;
+    if (!size)
+        size = sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+static size_t zero_pages_map_size(size_t size) {
+    return page_size() + round_size_to_alignment(page_size(), size);
+}
+
+// Map a view of size bytes on zero pages, or return NULL if mmap fails.
+static void *zero_pages_alloc(size_t size,
+                              __cilk_reduce_range_fn reduce_range) {
+    char *mem = mmap(NULL, zero_pages_map_size(size), PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+        return NULL;
+#ifdef MADV_NOHUGEPAGE
+    // Keep huge pages from turning a single touch into 2 MB of zeroing.
+    madvise(mem, zero_pages_map_size(size), MADV_NOHUGEPAGE);
+#endif
+    struct zero_pages_header *header = (struct zero_pages_header *)mem;
+    header->size = size;
+    header->reduce_range = reduce_range;
+    return mem + page_size();
+}
+
+static struct zero_pages_header *zero_pages_header(void *view) {
+    return (struct zero_pages_header *)((char *)view - page_size());
+}
+
+// File descriptor of /proc/self/pagemap, or -1 if it is not available.
+static int pagemap_fd(void) {
+#ifdef __linux__
+    static _Atomic int fd = -2;
+    int cur = atomic_load_explicit(&fd, memory_order_relaxed);
+    if (cur == -2) {
+        int opened = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+        if (atomic_compare_exchange_strong(&fd, &cur, opened))
+            cur = opened;
+        else if (opened >= 0)
+            close(opened);
+    }
+    return cur;
+#else
+    return -1;
+#endif
+}
+
+#define PAGEMAP_PRESENT (1ULL << 63)
+#define PAGEMAP_SWAPPED (1ULL << 62)
+#define PAGEMAP_BATCH 512
+
+// Reduce the zero-pages view right into the view left, calling the
+// reduce_range function of right on each run of pages of right that has
+// been touched, which the page table of right records.  Unlike mincore,
+// /proc/self/pagemap also reports touched pages that are swapped out.  If
+// pagemap cannot be read, reduce the whole view.
+static void reduce_zero_pages(void *left, void *right) {
+    struct zero_pages_header *header = zero_pages_header(right);
+    size_t size = header->size;
+    size_t pagesize = page_size();
+    size_t pages = round_size_to_alignment(pagesize, size) / pagesize;
+    int fd = pagemap_fd();
+    // First page of the current run of touched pages, or pages if none.
+    size_t run = fd < 0 ? 0 : pages;
+    uint64_t entries[PAGEMAP_BATCH];
+    for (size_t i = 0; i < pages && fd >= 0;) {
+        size_t n = pages - i < PAGEMAP_BATCH ? pages - i : PAGEMAP_BATCH;
+        off_t offset =
+            (off_t)(((uintptr_t)right / pagesize + i) * sizeof(uint64_t));
+        if (pread(fd, entries, n * sizeof(uint64_t), offset) !=
+            (ssize_t)(n * sizeof(uint64_t))) {
+            // Treat the rest of the view as touched.
+            if (run == pages)
+                run = i;
+            break;
+        }
+        for (size_t j = 0; j < n; ++j, ++i) {
+            bool touched = entries[j] & (PAGEMAP_PRESENT | PAGEMAP_SWAPPED);
+            if (touched && run == pages) {
+                run = i;
+            } else if (!touched && run < pages) {
+                header->reduce_range(left, right, run * pagesize,
+                                     (i - run) * pagesize);
+                run = pages;
+            }
+        }
+    }
+    if (run < pages)
+        header->reduce_range(left, right, run * pagesize,
+                             size - run * pagesize);
+}
+
+void free_view(reducer_base *rb) {
+    if (rb->slab == ZERO_PAGES_VIEW) {
+        struct zero_pages_header *header = zero_pages_header(rb->view);
+        munmap(header, zero_pages_map_size(header->size));
+    } else if (rb->slab) {
+        view_slab_release(rb->slab);
+    } else {
+        free(rb->view);
+    }
+}
+
+// Reduce the view right into the view left with reduce, and free right.
+static void reduce_and_free(__cilk_reduce_fn reduce, void *left,
+                            reducer_base *right) {
+    if (right->slab == ZERO_PAGES_VIEW)
+        reduce_zero_pages(left, right->view);
+    else
+        reduce(left, right->view);
+    free_view(right);
+}
+
 void *__cilkrts_insert_new_view(hyper_table *table, uintptr_t key, size_t size,
                                 __cilk_identity_fn identity,
                                 __cilk_reduce_fn reduce) {
     // Create a new view and initialize it with the identity function.
-    void *new_view = cilk_aligned_alloc(64, round_size_to_alignment(64, size));
-    identity(new_view);
+    struct view_slab *slab = NULL;
+    void *new_view = NULL;
+    __cilk_reduce_range_fn reduce_range;
+    if (size >= ZERO_PAGES_MIN_SIZE &&
+        (reduce_range = zero_identity_reduce(identity)))
+        new_view = zero_pages_alloc(size, reduce_range);
+    if (new_view) {
+        // A view mapped on zero pages is already zeroed.
+        slab = ZERO_PAGES_VIEW;
+    } else if (size <= SMALL_VIEW_SIZE && table->pooled &&
+               !is_parallel_reduce(reduce) && !is_commutative_reduce(reduce)) {
+        // Views of reducers with parallel reduce functions are freed by
+        // whichever worker runs their deferred reductions, and views of
+        // commutative reducers leave their table for another one, so they
+        // cannot share a slab.
+        new_view = view_slab_alloc(table, &slab);
+        identity(new_view);
+    } else {
+        new_view = cilk_aligned_alloc(64, round_size_to_alignment(64, size));
+        identity(new_view);
+    }
     // Insert the new view into the local hypertable.
     struct bucket new_bucket = {
         .key = (uintptr_t)key,
-        .value = {.view = new_view, .reduce_fn = reduce}};
+        .value = {.view = new_view, .reduce_fn = reduce, .slab = slab}};
     bool success = insert_hyperobject(table, new_bucket);
     assert(success);
     (void)success;
+    lookup_cache_fill(table, key, new_view);
     // Return the new view.
     return new_view;
 }
 
+///////////////////////////////////////////////////////////////////////////
+// Reduce functions registered as parallel or commutative.
+
+#define MAX_FLAGGED_REDUCES 16
+
+struct reduce_set {
+    __cilk_reduce_fn fns[MAX_FLAGGED_REDUCES];
+    _Atomic int count;
+};
+
+static struct reduce_set parallel_reduces, commutative_reduces;
+
+static bool reduce_set_has(struct reduce_set *set, __cilk_reduce_fn reduce) {
+    int n = atomic_load_explicit(&set->count, memory_order_acquire);
+    for (int i = 0; i < n; ++i) {
+        if (set->fns[i] == reduce)
+            return true;
+    }
+    return false;
+}
+
+static int reduce_set_add(struct reduce_set *set, __cilk_reduce_fn reduce) {
+    int ret = 0;
+    pthread_mutex_lock(&registration_lock);
+    int n = atomic_load_explicit(&set->count, memory_order_relaxed);
+    if (!reduce_set_has(set, reduce)) {
+        if (n == MAX_FLAGGED_REDUCES) {
+            ret = -1;
+        } else {
+            set->fns[n] = reduce;
+            atomic_store_explicit(&set->count, n + 1, memory_order_release);
+        }
+    }
+    pthread_mutex_unlock(&registration_lock);
+    return ret;
+}
+
+int add_parallel_reduce(__cilk_reduce_fn reduce) {
+    return reduce_set_add(&parallel_reduces, reduce);
+}
+
+bool is_parallel_reduce(__cilk_reduce_fn reduce) {
+    return reduce_set_has(&parallel_reduces, reduce);
+}
+
+int add_commutative_reduce(__cilk_reduce_fn reduce) {
+    return reduce_set_add(&commutative_reduces, reduce);
+}
+
+bool is_commutative_reduce(__cilk_reduce_fn reduce) {
+    return reduce_set_has(&commutative_reduces, reduce);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Deferred reductions.
+
+// Reduce the view right into the view left, two views of key that a merge
+// brings together, and free the right view.  If the reduce function is
+// parallel, append the reduction to the list at *tail instead, and drop key
+// from the lookup cache of table, the merged table, so that its next lookup
+// runs the reduction.
+static void reduce_views(hyper_table *table, uintptr_t key, reducer_base *left,
+                         reducer_base *right,
+                         struct deferred_reduce ***tail) {
+    // The view that a reducer registers is its leftmost view, which must
+    // survive the merge.  Views of commutative reducers are merged out of
+    // order, so it may be on the right; reduce the other one into it.  The
+    // view of key in table changes, so drop it from the lookup cache.
+    if (right->view == (void *)key && is_commutative_reduce(left->reduce_fn)) {
+        reducer_base tmp = *left;
+        *left = *right;
+        *right = tmp;
+        lookup_cache_forget(table, key);
+    }
+    if (!is_parallel_reduce(left->reduce_fn)) {
+        reduce_and_free(left->reduce_fn, left->view, right);
+        return;
+    }
+    struct deferred_reduce *d = malloc(sizeof(struct deferred_reduce));
+    d->key = key;
+    d->right = *right;
+    d->next = NULL;
+    **tail = d;
+    *tail = &d->next;
+    lookup_cache_forget(table, key);
+}
+
+// Set the deferred reductions of the table merged from left and right: those
+// of left, then those the merge deferred, then those of right.
+static void merge_deferred(hyper_table *table, struct deferred_reduce *left,
+                           struct deferred_reduce *merged,
+                           struct deferred_reduce **merged_tail,
+                           struct deferred_reduce *right) {
+    *merged_tail = right;
+    struct deferred_reduce **tail = &left;
+    while (*tail)
+        tail = &(*tail)->next;
+    *tail = merged;
+    table->deferred = left;
+}
+
+bool run_deferred_reductions(hyper_table *table, uintptr_t key) {
+    // Unlink the reductions into the view of key, in order, before running
+    // any, since running them may change table.
+    struct deferred_reduce *list = NULL, **tail = &list;
+    for (struct deferred_reduce **p = &table->deferred; *p;) {
+        struct deferred_reduce *d = *p;
+        if (d->key == key) {
+            *p = d->next;
+            *tail = d;
+            tail = &d->next;
+        } else {
+            p = &d->next;
+        }
+    }
+    *tail = NULL;
+    if (!list)
+        return false;
+
+    reducer_base *b = find_hyperobject(table, key);
+    assert(b && "Deferred reduction into a missing view.");
+    void *view = b->view;
+    __cilk_reduce_fn reduce = b->reduce_fn;
+    while (list) {
+        struct deferred_reduce *d = list;
+        list = d->next;
+        reduce_and_free(reduce, view, &d->right);
+        free(d);
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Commutative reductions.
+
+hyper_table *split_commutative_views(hyper_table *table) {
+    if (!table || table->commutative == 0)
+        return NULL;
+    hyper_table *split = NULL;
+    int32_t capacity = table->capacity < MIN_HT_CAPACITY ? table->occupancy
+                                                          : table->capacity;
+    // Stop scanning once every entry table counts as commutative is found.
+    for (int32_t i = 0;
+         i < capacity && (!split || split->occupancy < table->commutative);
+         ++i) {
+        if (!is_valid(table->keys[i]) ||
+            !is_commutative_reduce(table->values[i].reduce_fn))
+            continue;
+        if (!split)
+            split = local_hyper_table_alloc(MIN_CAPACITY);
+        insert_hyperobject(split, get_entry(table, i));
+    }
+    if (!split)
+        return NULL;
+
+    // Remove the views from table only now, since removals may rebuild it.
+    int32_t split_capacity = split->capacity < MIN_HT_CAPACITY
+                                 ? split->occupancy
+                                 : split->capacity;
+    for (int32_t i = 0; i < split_capacity; ++i) {
+        if (is_valid(split->keys[i]))
+            remove_hyperobject(table, split->keys[i]);
+    }
+    // Move the deferred reductions into the views that moved, in order.
+    struct deferred_reduce **tail = &split->deferred;
+    for (struct deferred_reduce **p = &table->deferred; *p;) {
+        struct deferred_reduce *d = *p;
+        if (is_commutative_reduce(d->right.reduce_fn)) {
+            *p = d->next;
+            *tail = d;
+            tail = &d->next;
+        } else {
+            p = &d->next;
+        }
+    }
+    *tail = NULL;
+    return split;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Merging tables.
+
+// Cursor over the valid entries of a hash table in order of their hashes in
+// a table of capacity out_capacity, a multiple of the table's capacity.
+//
+// Ordered linear probing keeps the entries of a table sorted by hash,
+// except that a run wrapping around the end of the table continues at its
+// start, where the entries have hashes above their indices.  A pass over the
+// table therefore visits the entries whose hashes do not exceed their
+// indices and then wraps to visit the others, which end before the first
+// empty entry.  Each hash of the table expands into out_capacity / capacity
+// hashes of the larger table, so the cursor makes that many passes, each
+// visiting the entries of one such hash-range in turn.
+struct entry_cursor {
+    const hyper_table *table;
+    int32_t out_capacity;
+    index_t round;   // Which hash range of the larger table this pass visits.
+    index_t i;       // Index of the current entry, or capacity when done.
+    bool wrapped;    // Whether this pass visits the wrapped run.
+    index_t hash;    // Hash of the current entry in the larger table.
+};
+
+static inline index_t cursor_hash(const struct entry_cursor *c, index_t i) {
+    const hyper_table *t = c->table;
+    if (c->out_capacity == t->capacity)
+        return t->hashes[i];
+    return get_table_entry(c->out_capacity, t->keys[i]);
+}
+
+// Move the cursor to the next entry in order, starting at entry c->i.
+static void cursor_seek(struct entry_cursor *c) {
+    const hyper_table *t = c->table;
+    const uintptr_t *keys = t->keys;
+    const index_t *hashes = t->hashes;
+    index_t capacity = t->capacity;
+    index_t i = c->i;
+    while (true) {
+        if (!c->wrapped) {
+            for (; i < capacity; ++i) {
+                if (is_valid(keys[i]) && hashes[i] <= i) {
+                    index_t h = cursor_hash(c, i);
+                    if (h / capacity == c->round) {
+                        c->i = i;
+                        c->hash = h;
+                        return;
+                    }
+                }
+            }
+            c->wrapped = true;
+            i = 0;
+        }
+        for (; i < capacity && !is_empty(keys[i]); ++i) {
+            if (is_valid(keys[i]) && hashes[i] > i) {
+                index_t h = cursor_hash(c, i);
+                if (h / capacity == c->round) {
+                    c->i = i;
+                    c->hash = h;
+                    return;
+                }
+            }
+        }
+        if (++c->round == c->out_capacity / capacity) {
+            c->i = capacity;
+            return;
+        }
+        c->wrapped = false;
+        i = 0;
+    }
+}
+
+static void cursor_init(struct entry_cursor *c, const hyper_table *table,
+                        int32_t out_capacity) {
+    *c = (struct entry_cursor){
+        .table = table, .out_capacity = out_capacity, .round = 0, .i = 0,
+        .wrapped = false};
+    cursor_seek(c);
+}
+
+static inline bool cursor_done(const struct entry_cursor *c) {
+    return c->i == c->table->capacity;
+}
+
+static inline void cursor_next(struct entry_cursor *c) {
+    ++c->i;
+    cursor_seek(c);
+}
+
+// Place bucket b into table, whose entries are being filled in order of
+// their hashes.  *next is the index after the last entry placed.
+static void place_entry(hyper_table *table, struct bucket b, index_t *next) {
+    index_t i = b.hash > *next ? b.hash : *next;
+    if (i >= table->capacity) {
+        // The last run wraps around the end of the table.  Let an insertion
+        // shift the entries at the start of the table out of its way.
+        bool success = insert_entry(table, b);
+        assert(success);
+        (void)success;
+        return;
+    }
+    set_entry(table, i, b);
+    ++table->occupancy;
+    *next = i + 1;
+}
+
+// Count the keys in either of the hash tables left and right, visiting both in
+// the order of their hashes in a table of the given capacity.
+static int32_t count_merged(const hyper_table *left, hyper_table *right,
+                            int32_t capacity) {
+    int32_t count = left->occupancy + right->occupancy;
+    struct entry_cursor l, r;
+    cursor_init(&l, left, capacity);
+    cursor_init(&r, right, capacity);
+    while (!cursor_done(&l) && !cursor_done(&r)) {
+        if (l.hash < r.hash) {
+            cursor_next(&l);
+        } else if (r.hash < l.hash) {
+            cursor_next(&r);
+        } else {
+            uintptr_t key = left->keys[l.i];
+            if (right->keys[r.i] == key) {
+                cursor_next(&r);
+                --count;
+            } else if (find_hyperobject(right, key)) {
+                --count;
+            }
+            cursor_next(&l);
+        }
+    }
+    return count;
+}
+
+// Merge the hash table right into the hash table left in one pass over both
+// in hash order, like the merge step of merge sort, building entry arrays
+// for left of the given capacity.  That capacity must be a multiple of the
+// capacities of both tables, so that the merged order is the order of the
+// entries in each table.  The views of left stay where they are.
+static void merge_ordered(hyper_table *left, hyper_table *right,
+                          int32_t capacity) {
+    hyper_table old = *left;
+    entry_arrays_create(left, capacity);
+    left->capacity = capacity;
+    left->occupancy = 0;
+    left->commutative += right->commutative;
+    // As in rebuild_table, keep the insertions of wrapped entries from
+    // triggering a rebuild.
+    left->ins_rm_count = -(old.occupancy + right->occupancy);
+
+    struct entry_cursor l, r;
+    cursor_init(&l, &old, capacity);
+    cursor_init(&r, right, capacity);
+    index_t next = 0;
+    struct deferred_reduce *deferred = NULL, **deferred_tail = &deferred;
+    while (!cursor_done(&l) || !cursor_done(&r)) {
+        if (cursor_done(&l) || (!cursor_done(&r) && r.hash < l.hash)) {
+            struct bucket b = get_entry(right, r.i);
+            b.hash = r.hash;
+            place_entry(left, b, &next);
+            cursor_next(&r);
+            continue;
+        }
+        struct bucket b = get_entry(&old, l.i);
+        b.hash = l.hash;
+        if (!cursor_done(&r) && r.hash == l.hash) {
+            // The key of the left entry can only be in right among the
+            // entries with the same hash, which usually hold only that key.
+            reducer_base *rb = NULL;
+            index_t ri = r.i;
+            if (right->keys[ri] == b.key) {
+                rb = &right->values[ri];
+                cursor_next(&r);
+            } else if ((rb = find_hyperobject(right, b.key))) {
+                // Drop the entry from right, so the cursor skips it.
+                ri = rb - right->values;
+                make_tombstone(&right->keys[ri]);
+                right->hashes[ri] = tombstone_hash(ri);
+            }
+            if (rb) {
+                left->commutative -= is_commutative_reduce(rb->reduce_fn);
+                // Merge the two views, preserving left-to-right ordering,
+                // and free the right view.
+                reduce_views(left, b.key, &b.value, rb, &deferred_tail);
+            }
+        }
+        place_entry(left, b, &next);
+        cursor_next(&l);
+    }
+    left->ins_rm_count = 0;
+    merge_deferred(left, old.deferred, deferred, deferred_tail,
+                   right->deferred);
+    right->deferred = NULL;
+
+    hyper_table_mem_free(old.keys, hyper_table_entries_size(old.capacity),
+                         left->pooled);
+}
+
+// Merging tables of unequal occupancy by lookups into the fuller table costs
+// time proportional to the occupancy of the other.  Merge two hash tables in
+// order instead once the other holds at least 1/MERGE_ORDERED_RATIO of the
+// entries of the merged table.
+static const int32_t MERGE_ORDERED_RATIO = 8;
+
 // Merge two hypertables, left and right.  Returns the merged hypertable and
 // deletes the other.
 hyper_table *merge_two_hts(hyper_table *restrict left,
@@ -410,39 +1230,77 @@ hyper_table *merge_two_hts(hyper_table *restrict left,
         left_dst = false;
     }
 
+    int32_t total = left->occupancy + right->occupancy;
+    if (src->capacity >= MIN_HT_CAPACITY && dst->capacity >= MIN_HT_CAPACITY &&
+        src->occupancy * MERGE_ORDERED_RATIO >= total) {
+        // Size the merged table for the keys in either table, which usually
+        // share many keys, and at least as large as either.
+        int32_t capacity = left->capacity > right->capacity ? left->capacity
+                                                            : right->capacity;
+        if (is_overloaded(total, capacity))
+            total = count_merged(left, right, capacity);
+        while (is_overloaded(total, capacity))
+            capacity *= 2;
+        merge_ordered(left, right, capacity);
+        local_hyper_table_free(right);
+        return left;
+    }
+
     int32_t src_capacity =
         (src->capacity < MIN_HT_CAPACITY) ? src->occupancy : src->capacity;
-    struct bucket *src_buckets = src->buckets;
-    // Iterate over the contents of the source hyper_table.
+    struct deferred_reduce *deferred = NULL, **deferred_tail = &deferred;
+    // Look up each valid key in the source hyper_table in the destination,
+    // and merge the views of keys in both.  Count the keys that the
+    // destination lacks, to grow it at most once before inserting them.
+    int32_t missing = 0;
     for (int32_t i = 0; i < src_capacity; ++i) {
-        struct bucket b = src_buckets[i];
-        if (!is_valid(b.key))
+        if (!is_valid(src->keys[i]))
             continue;
+        reducer_base *src_rb = &src->values[i];
+        reducer_base *dst_rb = find_hyperobject(dst, src->keys[i]);
 
-        // For each valid key in the source table, lookup that key in the
-        // destination table.
-        struct bucket *dst_bucket = find_hyperobject(dst, b.key);
-
-        if (NULL == dst_bucket) {
-            // The destination table does not contain this key.  Insert the
-            // key-value pair from the source table into the destination.
-            insert_hyperobject(dst, b);
+        if (NULL == dst_rb) {
+            ++missing;
+            continue;
+        }
+        // Merge the two views in the source and destination buckets, being
+        // sure to preserve left-to-right ordering.  Free the right view
+        // when done.
+        if (left_dst) {
+            reduce_views(dst, src->keys[i], dst_rb, src_rb, &deferred_tail);
         } else {
-            // Merge the two views in the source and destination buckets, being
-            // sure to preserve left-to-right ordering.  Free the right view
-            // when done.
-            reducer_base dst_rb = dst_bucket->value;
-            if (left_dst) {
-                dst_rb.reduce_fn(dst_rb.view, b.value.view);
-                free(b.value.view);
-            } else {
-                dst_rb.reduce_fn(b.value.view, dst_rb.view);
-                free(dst_rb.view);
-                dst_bucket->value.view = b.value.view;
-            }
+            reduce_views(dst, src->keys[i], src_rb, dst_rb, &deferred_tail);
+            dst_rb->view = src_rb->view;
+            dst_rb->slab = src_rb->slab;
+            lookup_cache_forget(dst, src->keys[i]);
+        }
+        // Mark the entry as merged.
+        make_tombstone(&src->keys[i]);
+    }
+
+    if (missing > 0) {
+        // Grow the destination up front, rather than possibly several times
+        // while inserting.
+        total = dst->occupancy + missing;
+        int32_t capacity = dst->capacity;
+        if (capacity < MIN_HT_CAPACITY && total > capacity)
+            capacity = MIN_HT_CAPACITY;
+        while (capacity >= MIN_HT_CAPACITY && is_overloaded(total, capacity))
+            capacity *= 2;
+        if (capacity != dst->capacity)
+            rebuild_table(dst, capacity);
+
+        // Insert the key-value pairs the destination lacks.
+        for (int32_t i = 0; i < src_capacity; ++i) {
+            if (is_valid(src->keys[i]))
+                insert_hyperobject(dst, get_entry(src, i));
         }
     }
 
+    merge_deferred(dst, left->deferred, deferred, deferred_tail,
+                   right->deferred);
+    src->deferred = NULL;
+
     // Destroy the source hyper_table, and return the destination.
     local_hyper_table_free(src);
 
@@ -10,7 +10,8 @@
 
 typedef uint32_t index_t;
 
-// An entry in the hash table.
+// An entry of the hash table, as passed to insert_hyperobject.  The table
+// itself stores the fields of its entries in separate arrays.
 struct bucket {
     uintptr_t key; /* EMPTY, DELETED, or a user-provided pointer. */
     index_t hash;  /* hash of the key when inserted into the table. */
@@ -27,28 +28,112 @@ static inline bool is_valid(uintptr_t key) {
     return !is_empty(key) && !is_tombstone(key);
 }
 
+// An entry of the lookup cache of a table.
+struct lookup_cache_entry {
+    uintptr_t key; /* EMPTY or a key in the table. */
+    void *view;
+};
+
+// A reduction of the view right into the view of key in a table, deferred
+// from the merge that brought the two views together.
+struct deferred_reduce {
+    uintptr_t key;
+    reducer_base right;
+    struct deferred_reduce *next;
+};
+
+// Number of entries in the lookup cache of a table.
+#define LOOKUP_CACHE_BITS 4
+#define LOOKUP_CACHE_SIZE (1 << LOOKUP_CACHE_BITS)
+
 // Hash table of reducers.  We don't need any locking or support for
 // concurrent updates, since the hypertable is local.
+//
+// The entries are stored as a structure of arrays, so that a probe, which
+// mostly reads keys and hashes, scans dense arrays of them and touches the
+// values only on a hit.  The three arrays share one allocation, keys first.
+// Empty entries and tombstones in a hash table carry the hashes given by
+// empty_hash() and tombstone_hash(), which let a probe decide where it stops
+// from the hashes alone.
 typedef struct local_hyper_table {
     index_t capacity;
     int32_t occupancy;
     int32_t ins_rm_count;
-    struct bucket *buckets;
+    int32_t commutative; // entries of reducers with commutative reduce_fn
+    bool pooled; // table and entries come from the worker's memory pool
+    struct view_slab *view_slab; // slab new small views are carved out of
+    uintptr_t *keys;
+    index_t *hashes;
+    reducer_base *values;
+    // Reductions with parallel reduce functions deferred to Cilk code, in
+    // the order they must run for each key.
+    struct deferred_reduce *deferred;
+    // Direct-mapped cache of the views of recently looked-up keys.  Views
+    // never move, so only removing or replacing a view, or deferring a
+    // reduction into it, invalidates its entry.
+    struct lookup_cache_entry cache[LOOKUP_CACHE_SIZE];
 } hyper_table;
 
 hyper_table *__cilkrts_local_hyper_table_alloc(void);
 CHEETAH_INTERNAL
+hyper_table *local_hyper_table_alloc(int32_t capacity);
+CHEETAH_INTERNAL
 void local_hyper_table_free(hyper_table *table);
 
+// Memory for tables and their bucket arrays.  The runtime pools it per
+// worker when hyper_table_mem_pooled() says so; the choice is made once per
+// table and passed back to allocate and free its memory.
+CHEETAH_INTERNAL bool hyper_table_mem_pooled(void);
+CHEETAH_INTERNAL void *hyper_table_mem_alloc(size_t size, bool pooled);
+CHEETAH_INTERNAL void hyper_table_mem_free(void *p, size_t size, bool pooled);
+
+// Size of the entry arrays of a table with the given capacity.
+static inline size_t hyper_table_entries_size(int32_t capacity) {
+    return (size_t)capacity *
+           (sizeof(uintptr_t) + sizeof(index_t) + sizeof(reducer_base));
+}
+
 CHEETAH_INTERNAL
 bool remove_hyperobject(hyper_table *table, uintptr_t key);
 CHEETAH_INTERNAL
 bool insert_hyperobject(hyper_table *table, struct bucket b);
 
+// Identity functions registered as zeroing views, and the functions reducing
+// ranges of their views.  Large views with such an identity function are
+// mapped on zero pages, and only the pages touched are reduced.
+CHEETAH_INTERNAL int add_zero_identity(__cilk_identity_fn identity,
+                                       __cilk_reduce_range_fn reduce_range);
+CHEETAH_INTERNAL __cilk_reduce_range_fn
+zero_identity_reduce(__cilk_identity_fn identity);
+
+// Free a view created by __cilkrts_insert_new_view.
+CHEETAH_INTERNAL
+void free_view(reducer_base *rb);
+
 CHEETAH_INTERNAL
 hyper_table *merge_two_hts(hyper_table *restrict left,
                            hyper_table *restrict right);
 
+// Reduce functions registered as parallel do not run where two tables merge,
+// which is runtime code on the critical path of a join.  The merge records
+// the reduction instead, and the next lookup of the key runs it in Cilk code,
+// where reduce may spawn.
+CHEETAH_INTERNAL int add_parallel_reduce(__cilk_reduce_fn reduce);
+CHEETAH_INTERNAL bool is_parallel_reduce(__cilk_reduce_fn reduce);
+// Reduce functions registered as commutative may combine views in any order,
+// so the views of their reducers are merged as soon as a strand returns,
+// without waiting for the views of the strands between them.
+CHEETAH_INTERNAL int add_commutative_reduce(__cilk_reduce_fn reduce);
+CHEETAH_INTERNAL bool is_commutative_reduce(__cilk_reduce_fn reduce);
+// Move the views of commutative reducers in table into a new table, and
+// return it, or NULL if there are none.
+CHEETAH_INTERNAL hyper_table *split_commutative_views(hyper_table *table);
+// Run the reductions deferred into the view of key in table, if any, and
+// return whether there were any.  They may spawn, so table may no longer be
+// the table of the current strand afterwards.
+CHEETAH_INTERNAL bool run_deferred_reductions(hyper_table *table,
+                                              uintptr_t key);
+
 #ifndef MOCK_HASH
 // Data type for indexing the hash table.  This type is used for
 // hashes as well as the table's capacity.
@@ -185,27 +270,37 @@ static inline bool continue_probe(index_t tgt, index_t hash, index_t idx) {
     return (idx - tgt) <= (idx - hash);
 }
 
-static inline struct bucket *find_hyperobject_linear(hyper_table *table,
-                                                     uintptr_t key) {
+// The hash stored with an empty entry at index idx.  It stops every probe
+// except one that starts at idx, which must check for an empty entry itself.
+static inline index_t empty_hash(index_t idx) { return idx; }
+
+// The hash stored with a tombstone at index idx.  It never stops a probe.
+static inline index_t tombstone_hash(index_t idx) { return idx + 1; }
+
+static inline reducer_base *find_hyperobject_linear(hyper_table *table,
+                                                    uintptr_t key) {
     // If the table is small enough, just scan the array.
-    struct bucket *buckets = table->buckets;
+    uintptr_t *keys = table->keys;
     int32_t occupancy = table->occupancy;
 
     // Scan the array backwards, since inserts add new entries to
     // the end of the array, and we anticipate that the program
     // will exhibit locality of reference.
     for (int32_t i = occupancy - 1; i >= 0; --i)
-        if (buckets[i].key == key)
-            return &buckets[i];
+        if (keys[i] == key)
+            return &table->values[i];
 
     return NULL;
 }
 
-struct bucket *__cilkrts_find_hyperobject_hash(hyper_table *table,
-                                               uintptr_t key);
+reducer_base *__cilkrts_find_hyperobject_hash(hyper_table *table,
+                                              uintptr_t key);
 
-static inline struct bucket *find_hyperobject(hyper_table *table,
-                                              uintptr_t key) {
+// Find the entry for key and return a pointer to its value, or NULL if the
+// table has no entry for key.  The pointer is valid until the next insertion
+// or removal.
+static inline reducer_base *find_hyperobject(hyper_table *table,
+                                             uintptr_t key) {
     if (table->capacity < MIN_HT_CAPACITY) {
         return find_hyperobject_linear(table, key);
     } else {
@@ -213,6 +308,45 @@ static inline struct bucket *find_hyperobject(hyper_table *table,
     }
 }
 
+static inline struct lookup_cache_entry *
+lookup_cache_slot(hyper_table *table, uintptr_t key) {
+    // Keys are addresses of reducers, which are at least 8-byte aligned and
+    // often adjacent.  Fold the bits above the slot index into it, so that
+    // neighboring reducers and reducers spaced a power of two apart both
+    // spread over the cache.
+    uintptr_t x = key >> 3;
+    return &table->cache[(x ^ (x >> LOOKUP_CACHE_BITS)) &
+                         (LOOKUP_CACHE_SIZE - 1)];
+}
+
+// Return the view of key if the lookup cache of table holds it, or NULL.
+static inline void *lookup_cached_view(hyper_table *table, uintptr_t key) {
+    struct lookup_cache_entry *e = lookup_cache_slot(table, key);
+    return e->key == key ? e->view : NULL;
+}
+
+static inline void lookup_cache_fill(hyper_table *table, uintptr_t key,
+                                     void *view) {
+    struct lookup_cache_entry *e = lookup_cache_slot(table, key);
+    e->key = key;
+    e->view = view;
+}
+
+// Look up the view of key, consulting and filling the lookup cache of table.
+// Returns NULL if table has no view of key.
+static inline void *lookup_view(hyper_table *table, uintptr_t key) {
+    void *view = lookup_cached_view(table, key);
+    if (__builtin_expect(!!view, true))
+        return view;
+    reducer_base *b = find_hyperobject(table, key);
+    if (!b)
+        return NULL;
+    // Keep keys with deferred reductions out of the cache.
+    if (!table->deferred)
+        lookup_cache_fill(table, key, b->view);
+    return b->view;
+}
+
 void *__cilkrts_insert_new_view(hyper_table *table, uintptr_t key, size_t size,
                                 __cilk_identity_fn identity,
                                 __cilk_reduce_fn reduce);
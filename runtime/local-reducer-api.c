@@ -1,10 +1,58 @@
+#include <stdlib.h>
+
 #include "cilk-internal.h"
 #include "global.h"
 #include "hyperobject_base.h"
+#include "internal-malloc.h"
 #include "local-hypertable.h"
 #include "local-reducer-api.h"
+#include "local.h"
 #include "rts-config.h"
 
+// Largest capacity a new hypertable starts with.  The entry arrays of a
+// larger table would not come from the internal malloc pool.
+static const int32_t MAX_HYPER_TABLE_CAPACITY_HINT = 32;
+
+// Hypertables and their bucket arrays come from the internal malloc pool of
+// the current worker once the runtime has set it up.  Tables created before
+// then, e.g., by reducers registered in static constructors, use the system
+// heap for their whole life.
+bool hyper_table_mem_pooled(void) {
+    __cilkrts_worker *w = __cilkrts_get_tls_worker();
+    return w->l && w->l->im_desc.buckets[0].loaded;
+}
+
+void *hyper_table_mem_alloc(size_t size, bool pooled) {
+    if (pooled)
+        return cilk_internal_malloc(__cilkrts_get_tls_worker(), size,
+                                    IM_REDUCER_MAP);
+    return malloc(size);
+}
+
+void hyper_table_mem_free(void *p, size_t size, bool pooled) {
+    if (pooled)
+        cilk_internal_free(__cilkrts_get_tls_worker(), p, size,
+                           IM_REDUCER_MAP);
+    else
+        free(p);
+}
+
+hyper_table *__cilkrts_worker_hyper_table_alloc(__cilkrts_worker *w) {
+    return local_hyper_table_alloc(w->l ? w->l->hyper_table_capacity
+                                        : MIN_CAPACITY);
+}
+
+hyper_table *take_local_hyper_table(__cilkrts_worker *w) {
+    hyper_table *table = w->hyper_table;
+    w->hyper_table = NULL;
+    if (table)
+        w->l->hyper_table_capacity =
+            table->capacity < MAX_HYPER_TABLE_CAPACITY_HINT
+                ? table->capacity
+                : MAX_HYPER_TABLE_CAPACITY_HINT;
+    return table;
+}
+
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wdeprecated-declarations"
 
@@ -36,6 +84,9 @@ void __cilkrts_reducer_register_64(void *key, uint64_t size,
 
 void __cilkrts_reducer_unregister(void *key) {
     struct local_hyper_table *table = get_hyper_table();
+    // Finish the reductions into the view of key before dropping it.
+    while (table->deferred && run_deferred_reductions(table, (uintptr_t)key))
+        table = get_hyper_table();
     bool success = remove_hyperobject(table, (uintptr_t)key);
     /* CILK_ASSERT(success && "Failed to unregister reducer."); */
     (void)success;
@@ -47,11 +98,33 @@ CHEETAH_INTERNAL
 void *internal_reducer_lookup(__cilkrts_worker *w, void *key, size_t size,
                               void *identity_ptr, void *reduce_ptr) {
     struct local_hyper_table *table = get_local_hyper_table(w);
-    struct bucket *b = find_hyperobject(table, (uintptr_t)key);
-    if (__builtin_expect(!!b, true)) {
-        CILK_ASSERT_POINTER_EQUAL(key, (void *)b->key);
+    void *view = lookup_view(table, (uintptr_t)key);
+    if (__builtin_expect(!!view, true)) {
         // Return the existing view.
-        return b->value.view;
+        return view;
+    }
+
+    return __cilkrts_insert_new_view(table, (uintptr_t)key, size,
+                                     (__cilk_identity_fn)identity_ptr,
+                                     (__cilk_reduce_fn)reduce_ptr);
+}
+
+void *__cilkrts_reducer_lookup_uncached(void *key, size_t size,
+                                        void *identity_ptr, void *reduce_ptr) {
+    // The caller already missed in the lookup cache, so go straight to the
+    // table.
+    struct local_hyper_table *table = get_hyper_table();
+    reducer_base *b = find_hyperobject(table, (uintptr_t)key);
+    if (__builtin_expect(!!b, true)) {
+        // Run the reductions deferred into the view first.  They may spawn,
+        // leaving this strand with another table afterwards.
+        while (__builtin_expect(!!table->deferred, false) &&
+               run_deferred_reductions(table, (uintptr_t)key)) {
+            table = get_hyper_table();
+            b = find_hyperobject(table, (uintptr_t)key);
+        }
+        lookup_cache_fill(table, (uintptr_t)key, b->view);
+        return b->view;
     }
 
     return __cilkrts_insert_new_view(table, (uintptr_t)key, size,
@@ -59,9 +132,48 @@ void *internal_reducer_lookup(__cilkrts_worker *w, void *key, size_t size,
                                      (__cilk_reduce_fn)reduce_ptr);
 }
 
+int __cilkrts_reducer_set_parallel(__cilk_reduce_fn reduce) {
+    return add_parallel_reduce(reduce);
+}
+
+int __cilkrts_reducer_set_commutative(__cilk_reduce_fn reduce) {
+    return add_commutative_reduce(reduce);
+}
+
+int __cilkrts_reducer_set_zero_identity(__cilk_identity_fn identity,
+                                        __cilk_reduce_range_fn reduce_range) {
+    return add_zero_identity(identity, reduce_range);
+}
+
+void __cilkrts_run_deferred_reductions(void) {
+    struct local_hyper_table *table =
+        get_local_hyper_table_or_null(__cilkrts_get_tls_worker());
+    while (table && table->deferred) {
+        run_deferred_reductions(table, table->deferred->key);
+        table = get_local_hyper_table_or_null(__cilkrts_get_tls_worker());
+    }
+}
+
+void __cilkrts_check_view_handle(__cilkrts_view_handle h) {
+    // Outside of a cilkified region, the key is the view.
+    void *view = h.key;
+    if (!__cilkrts_need_to_cilkify) {
+        struct local_hyper_table *table =
+            get_local_hyper_table_or_null(__cilkrts_get_tls_worker());
+        view = table ? lookup_view(table, (uintptr_t)h.key) : NULL;
+    }
+    if (view != h.view)
+        cilkrts_bug("Stale view handle for reducer %p: "
+                    "handle has view %p, current strand has view %p",
+                    h.key, h.view, view);
+}
+
 CHEETAH_INTERNAL
 void internal_reducer_remove(__cilkrts_worker *w, void *key) {
     struct local_hyper_table *table = get_local_hyper_table(w);
+    reducer_base *b = find_hyperobject(table, (uintptr_t)key);
+    if (b)
+        free_view(b);
     bool success = remove_hyperobject(table, (uintptr_t)key);
     (void)success;
 }
@@ -5,10 +5,22 @@
 #include "global.h"
 #include "local-hypertable.h"
 
+// Allocate a hypertable for worker w, sized like the last one it gave up.
+hyper_table *__cilkrts_worker_hyper_table_alloc(__cilkrts_worker *w);
+// Take the worker's hypertable away, e.g., to deposit it in a closure.
+CHEETAH_INTERNAL hyper_table *take_local_hyper_table(__cilkrts_worker *w);
+// Slow path of __cilkrts_reducer_lookup, for keys missing from the lookup
+// cache of the current worker's hypertable.
+void *__cilkrts_reducer_lookup_uncached(void *key, size_t size,
+                                        void *identity_ptr, void *reduce_ptr);
+// Run the reductions deferred into any view of the current strand's table,
+// at the end of a Cilkified region.
+void __cilkrts_run_deferred_reductions(void);
+
 static inline struct local_hyper_table *
 get_local_hyper_table(__cilkrts_worker *w) {
     if (NULL == w->hyper_table) {
-        w->hyper_table = __cilkrts_local_hyper_table_alloc();
+        w->hyper_table = __cilkrts_worker_hyper_table_alloc(w);
     }
     return w->hyper_table;
 }
@@ -3,6 +3,8 @@
 
 #include <stdbool.h>
 
+#include <stdatomic.h> /* must follow stdbool.h */
+
 #include "internal-malloc-impl.h" /* for cilk_im_desc */
 
 struct local_state {
@@ -16,7 +18,14 @@ struct local_state {
     uint32_t wake_val;
 
     jmpbuf rts_ctx;
-    struct cilk_fiber_pool fiber_pool;
+    struct cilk_fiber_pool fiber_pool[NUM_STACK_SIZE_CLASSES];
+    // Fibers allocated by this worker and not yet freed, maintained only if
+    // options.fiber_cap is set.  Other workers decrement it when they free
+    // this worker's fibers.
+    _Atomic int fibers_in_use;
+    // Capacity of the last hypertable this worker gave up, used to size the
+    // next one it creates.
+    int32_t hyper_table_capacity;
     struct cilk_im_desc im_desc;
     struct sched_stats stats;
 };
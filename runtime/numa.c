@@ -0,0 +1,162 @@
+#if defined __linux__ && !defined _GNU_SOURCE
+#define _GNU_SOURCE // For sched_getcpu from sched.h
+#endif
+
+#include <dirent.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "debug.h"
+#include "global.h"
+#include "numa.h"
+
+#define SYSFS_NODE_DIR "/sys/devices/system/node"
+
+// Upper bound on the number of nodes we apply memory policies for.
+#define MAX_NUMA_NODES 1024
+
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+//=========================================================
+// Private helper functions
+//=========================================================
+
+/* Parse a sysfs CPU list, e.g., "0-3,8-11", marking each listed CPU as
+   belonging to node. */
+static void parse_cpulist(struct cilk_numa_topology *t, const char *list,
+                          int node) {
+    const char *p = list;
+    while (*p) {
+        char *end;
+        long lo = strtol(p, &end, 10);
+        if (end == p)
+            break;
+        long hi = lo;
+        p = end;
+        if (*p == '-') {
+            hi = strtol(p + 1, &end, 10);
+            p = end;
+        }
+        for (long cpu = lo; cpu <= hi; ++cpu) {
+            if (cpu >= 0 && (unsigned long)cpu < t->ncpus)
+                t->cpu_to_node[cpu] = node;
+        }
+        if (*p == ',')
+            ++p;
+        else
+            break;
+    }
+}
+
+/* Read the topology from sysfs.  On failure, leave a single node. */
+static void read_os_topology(struct cilk_numa_topology *t) {
+    long ncpus = sysconf(_SC_NPROCESSORS_CONF);
+    DIR *dir = opendir(SYSFS_NODE_DIR);
+    if (ncpus <= 0 || dir == NULL) {
+        if (dir)
+            closedir(dir);
+        return;
+    }
+
+    t->ncpus = ncpus;
+    t->cpu_to_node = malloc(ncpus * sizeof(*t->cpu_to_node));
+    for (long cpu = 0; cpu < ncpus; ++cpu)
+        t->cpu_to_node[cpu] = -1;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        unsigned int node;
+        char path[sizeof(SYSFS_NODE_DIR) + 256 + sizeof("/cpulist")];
+        char list[4096];
+        if (sscanf(entry->d_name, "node%u", &node) != 1 ||
+            node >= MAX_NUMA_NODES)
+            continue;
+        snprintf(path, sizeof(path), SYSFS_NODE_DIR "/%s/cpulist",
+                 entry->d_name);
+        FILE *fp = fopen(path, "r");
+        if (fp == NULL)
+            continue;
+        if (fgets(list, sizeof(list), fp) != NULL) {
+            parse_cpulist(t, list, node);
+            // Node numbers may be sparse; unused numbers get empty pools.
+            if (node >= t->nnodes)
+                t->nnodes = node + 1;
+        }
+        fclose(fp);
+    }
+    closedir(dir);
+}
+
+//=========================================================
+// Supported public functions
+//=========================================================
+
+void cilk_numa_init(global_state *g) {
+    struct cilk_numa_topology *t = &g->numa;
+    t->nnodes = 1;
+    t->mock = false;
+    t->ncpus = 0;
+    t->cpu_to_node = NULL;
+
+    long mock_nodes = env_get_int("CILK_NUMA_NODES");
+    if (mock_nodes > 0) {
+        CILK_ASSERT(mock_nodes <= MAX_NUMA_NODES);
+        t->nnodes = mock_nodes;
+        t->mock = true;
+    } else {
+        read_os_topology(t);
+    }
+    cilkrts_alert(BOOT, "(cilk_numa_init) %u %sNUMA node(s)", t->nnodes,
+                  t->mock ? "mock " : "");
+}
+
+void cilk_numa_destroy(global_state *g) {
+    struct cilk_numa_topology *t = &g->numa;
+    free(t->cpu_to_node);
+    t->cpu_to_node = NULL;
+    t->ncpus = 0;
+    t->nnodes = 0;
+}
+
+unsigned int cilk_numa_worker_node(global_state *g, worker_id self) {
+    const struct cilk_numa_topology *t = &g->numa;
+    if (t->nnodes <= 1)
+        return 0;
+    if (t->mock)
+        return (unsigned long)self * t->nnodes / g->options.nproc;
+#ifdef __linux__
+    // Without pinning this is the node of the CPU the thread happens to run
+    // on right now, so callers ask again from time to time.
+    int cpu = sched_getcpu();
+    if (cpu >= 0 && (unsigned)cpu < t->ncpus && t->cpu_to_node[cpu] >= 0)
+        return t->cpu_to_node[cpu];
+#endif
+    return 0;
+}
+
+void cilk_numa_bind(void *addr, size_t len, int node) {
+#if defined __linux__ && defined SYS_mbind
+    if (node < 0 || node >= MAX_NUMA_NODES)
+        return;
+    unsigned long mask[MAX_NUMA_NODES / (8 * sizeof(unsigned long))];
+    const unsigned int bits = 8 * sizeof(unsigned long);
+    memset(mask, 0, sizeof(mask));
+    mask[node / bits] = 1UL << (node % bits);
+    // A preferred policy falls back to other nodes when the node is out of
+    // memory, so failure here only costs locality.
+    (void)syscall(SYS_mbind, addr, len, MPOL_PREFERRED, mask,
+                  (unsigned long)MAX_NUMA_NODES + 1, 0);
+#else
+    (void)addr;
+    (void)len;
+    (void)node;
+#endif
+}
@@ -0,0 +1,38 @@
+#ifndef _CILK_NUMA_H
+#define _CILK_NUMA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "cilk-internal.h"
+#include "rts-config.h"
+#include "types.h"
+
+// Description of the NUMA nodes of the machine, as seen by the fiber pools.
+//
+// The topology normally comes from the operating system.  For testing on
+// single-node machines, the environment variable CILK_NUMA_NODES=<n> replaces
+// it with <n> mock nodes, with workers assigned to nodes in contiguous
+// blocks.  Mock nodes have no memory of their own, so no memory policy is
+// ever applied for them.
+struct cilk_numa_topology {
+    unsigned int nnodes;  // number of nodes, at least 1
+    bool mock;            // true if the nodes are fake
+    unsigned int ncpus;   // size of cpu_to_node
+    int *cpu_to_node;     // node of each CPU, or -1 if unknown
+};
+
+CHEETAH_INTERNAL void cilk_numa_init(global_state *g);
+CHEETAH_INTERNAL void cilk_numa_destroy(global_state *g);
+
+// Return the node the calling thread, running as worker self, belongs to.
+// Unless workers are pinned, the answer is only a best-effort guess, since
+// the OS may move the thread to another node at any time.
+CHEETAH_INTERNAL unsigned int cilk_numa_worker_node(global_state *g,
+                                                    worker_id self);
+
+// Ask the OS to back the (not yet touched) region [addr, addr + len) with
+// memory from the given node.  Does nothing if node is negative.
+CHEETAH_INTERNAL void cilk_numa_bind(void *addr, size_t len, int node);
+
+#endif /* _CILK_NUMA_H */
@@ -22,6 +22,9 @@ struct ReadyDeque {
     Closure *bottom;
     Closure *top __attribute__((aligned(CILK_CACHE_LINE)));
     _Atomic(worker_id) mutex_owner __attribute__((aligned(CILK_CACHE_LINE)));
+    // A suspended Closure handed to this worker to resume, MAILBOX_OPEN if
+    // the worker is stealing and accepts one, or NULL
+    _Atomic(Closure *) mailbox __attribute__((aligned(CILK_CACHE_LINE)));
 } __attribute__((aligned(CILK_CACHE_LINE)));
 
 /*********************************************************
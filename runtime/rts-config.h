@@ -62,6 +62,24 @@
 #define ENABLE_WORKER_PINNING 0
 #endif
 
+// Probe hypertables with SSE2 or AVX2 instructions when the target has them.
+#ifndef ENABLE_HYPERTABLE_SIMD
+#define ENABLE_HYPERTABLE_SIMD 1
+#endif
+
+// Give cilk_malloc and cilk_free calls from outside of workers a magazine
+// cache per CPU in front of the depot.  The current CPU is read from the
+// thread's rseq area on Linux, but a cache is claimed with a busy flag, not
+// an rseq critical section.  Worker buckets and fiber pools are not keyed by
+// CPU: they stay private to their worker, which needs no synchronization.
+#ifndef ENABLE_PERCPU_CACHE
+#define ENABLE_PERCPU_CACHE 0
+#endif
+
+#if ENABLE_PERCPU_CACHE && !defined __linux__
+#error "Invalid Cheetah RTS config: ENABLE_PERCPU_CACHE requires Linux"
+#endif
+
 #ifndef MIN_NUM_PAGES_PER_STACK
 #define MIN_NUM_PAGES_PER_STACK 4 // must be greater than 1
 #endif
@@ -90,10 +108,28 @@ _Static_assert(MAX_NUM_PAGES_PER_STACK >= MIN_NUM_PAGES_PER_STACK, "Invalid Chee
 #define DEFAULT_STACK_SIZE (1U << LG_STACK_SIZE) // 1 MBytes
 #endif
 
+#ifndef STACK_SIZE_CLASS_SHIFT
+// The small and large stack-size classes are the default stack size divided
+// or multiplied by 2^STACK_SIZE_CLASS_SHIFT.
+#define STACK_SIZE_CLASS_SHIFT 3
+#endif
+
 #ifndef DEFAULT_FIBER_POOL_CAP
 #define DEFAULT_FIBER_POOL_CAP 8 // initial per-worker fiber pool capacity
 #endif
 
+#ifndef DEFAULT_FIBER_CAP
+#define DEFAULT_FIBER_CAP 0 // max fibers in use per worker; 0 for no cap
+#endif
+
+#ifndef DEFAULT_FIBER_GLOBAL_CAP
+#define DEFAULT_FIBER_GLOBAL_CAP 0 // max fibers in use in total; 0 for no cap
+#endif
+
+#ifndef DEFAULT_RESUME_AFFINITY
+#define DEFAULT_RESUME_AFFINITY 0 // resume closures on the worker that synced
+#endif
+
 #ifndef MAX_CALLBACKS
 #define MAX_CALLBACKS 32 // Maximum number of init or exit callbacks
 #endif
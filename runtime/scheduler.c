@@ -23,6 +23,7 @@
 #include "global.h"
 #include "jmpbuf.h"
 #include "local-hypertable.h"
+#include "local-reducer-api.h"
 #include "local.h"
 #include "readydeque.h"
 #include "scheduler.h"
@@ -256,7 +257,8 @@ void Cilk_set_return(__cilkrts_worker *const w) {
 
     // all hyperobjects from child or right sibling must have been reduced
     CILK_ASSERT(t->child_ht == (hyper_table *)NULL &&
-                       t->right_ht == (hyper_table *)NULL);
+                       t->right_ht == (hyper_table *)NULL &&
+                       t->comm_ht == (hyper_table *)NULL);
     CILK_ASSERT(t->call_parent);
     CILK_ASSERT_NULL(t->spawn_parent);
     CILK_ASSERT((t->frame->flags & CILK_FRAME_DETACHED) == 0);
@@ -290,27 +292,108 @@ void Cilk_set_return(__cilkrts_worker *const w) {
     Closure_destroy(w, t);
 }
 
+// ==============================================
+// Mailboxes for resuming suspended closures
+// ==============================================
+
+/* With the resume_affinity option, a worker in the steal loop opens its
+   mailbox while it pauses between steal attempts.  The last child of a
+   suspended Closure to return hands the Closure to the worker whose sync
+   suspended it, if that worker's mailbox is open, so that the Closure
+   resumes where its stack and data are likely still in cache. */
+#define MAILBOX_OPEN ((Closure *)1)
+
+static inline void mailbox_open(ReadyDeque *deques, worker_id self) {
+    atomic_store_explicit(&deques[self].mailbox, MAILBOX_OPEN,
+                          memory_order_relaxed);
+}
+
+/* Close the mailbox and return the Closure handed to it, if any. */
+static inline Closure *mailbox_close(ReadyDeque *deques, worker_id self) {
+    Closure *t = atomic_exchange_explicit(&deques[self].mailbox, NULL,
+                                          memory_order_acquire);
+    return t == MAILBOX_OPEN ? NULL : t;
+}
+
+static inline bool mailbox_deliver(ReadyDeque *deques, worker_id pn,
+                                   Closure *t) {
+    Closure *open = MAILBOX_OPEN;
+    return atomic_load_explicit(&deques[pn].mailbox, memory_order_relaxed) ==
+               open &&
+           atomic_compare_exchange_strong_explicit(&deques[pn].mailbox, &open,
+                                                   t, memory_order_release,
+                                                   memory_order_relaxed);
+}
+
+/* Do a provably-good steal of t, which has finished its sync; this is
+   *really* simple. */
+static void provably_good_steal(__cilkrts_worker *const w, worker_id self,
+                                Closure *t) {
+    CILK_ASSERT(t->frame != NULL);
+
+    w->l->provably_good_steal = true;
+
+    setup_for_sync(w, self, t);
+    CILK_ASSERT(t->owner_ready_deque == NO_WORKER);
+    Closure_make_ready(t);
+}
+
+/* Combine the views that t's children left with t's own and set t up to
+   run on w, after a provably-good steal. */
+static void resume_after_sync(__cilkrts_worker *const w, Closure *t) {
+    hyper_table *child_ht = t->child_ht;
+    hyper_table *active_ht = t->user_ht;
+    hyper_table *comm_ht =
+        atomic_exchange_explicit(&t->comm_ht, NULL, memory_order_acquire);
+    t->child_ht = NULL;
+    t->user_ht = NULL;
+    w->hyper_table =
+        merge_two_hts(merge_two_hts(child_ht, active_ht), comm_ht);
+
+    setup_for_execution(w, t);
+}
+
+/* Take the Closure handed to this worker's mailbox, if any, and set it up
+   to run.  The mailbox is closed afterwards. */
+static Closure *take_from_mailbox(__cilkrts_worker *const w, worker_id self,
+                                  ReadyDeque *deques) {
+    Closure *t = mailbox_close(deques, self);
+    if (!t)
+        return NULL;
+
+    Closure_lock(self, t);
+    CILK_ASSERT(t->sync_worker == self);
+    CILK_ASSERT(t->status == CLOSURE_SUSPENDED && !Closure_has_children(t));
+    cilkrts_alert(STEAL | ALERT_SYNC, "(take_from_mailbox) resuming %p",
+                  (void *)t);
+    provably_good_steal(w, self, t);
+    resume_after_sync(w, t);
+    Closure_unlock(self, t);
+    return t;
+}
+
 static Closure *provably_good_steal_maybe(__cilkrts_worker *const w,
                                           worker_id self, Closure *parent) {
 
     Closure_assert_ownership(self, parent);
-    local_state *l = w->l;
     // cilkrts_alert(STEAL, "(provably_good_steal_maybe) cl %p",
     //               (void *)parent);
-    CILK_ASSERT(!l->provably_good_steal);
+    CILK_ASSERT(!w->l->provably_good_steal);
 
     if (!Closure_has_children(parent) && parent->status == CLOSURE_SUSPENDED) {
         // cilkrts_alert(STEAL | ALERT_SYNC,
         //      "(provably_good_steal_maybe) completing a sync");
 
-        CILK_ASSERT(parent->frame != NULL);
-
-        /* do a provably-good steal; this is *really* simple */
-        l->provably_good_steal = true;
+        worker_id sync_worker = parent->sync_worker;
+        if (w->g->options.resume_affinity && sync_worker != self &&
+            mailbox_deliver(w->g->deques, sync_worker, parent)) {
+            cilkrts_alert(STEAL | ALERT_SYNC,
+                          "(provably_good_steal_maybe) sent %p to W%u",
+                          (void *)parent, sync_worker);
+            return NULL;
+        }
 
-        setup_for_sync(w, self, parent);
-        CILK_ASSERT(parent->owner_ready_deque == NO_WORKER);
-        Closure_make_ready(parent);
+        provably_good_steal(w, self, parent);
 
         cilkrts_alert(STEAL | ALERT_SYNC,
                       "(provably_good_steal_maybe) returned %p",
@@ -347,6 +430,17 @@ static Closure *provably_good_steal_maybe(__cilkrts_worker *const w,
  * the child's right_ht may have something new again.  If that's the
  * case, we need to do the reduce again.
  *
+ * Views of commutative reducers need no sibling order, so they are published
+ * in the parent's comm_ht with compare-and-swap, without any lock.
+ *
+ * The parent's join_counter is atomic.  A child that is not the last one to
+ * return decrements it after unlocking the parent and is done.  Only the
+ * child that takes it to zero does so under the parent lock, which makes the
+ * decrement atomic with the parent's sync failing or succeeding, and checks
+ * for a provably-good steal.  Until the counter reaches zero the parent can
+ * neither pass its sync nor be freed, so the other children may still touch
+ * it after unlocking it.
+ *
  * This function returns a closure to be executed next, or NULL if none.
  * The child must not be locked by ourselves, and be in no deque.
  ***/
@@ -357,7 +451,8 @@ static Closure *Closure_return(__cilkrts_worker *const w, worker_id self,
     Closure *const parent = child->spawn_parent;
 
     CILK_ASSERT(child);
-    CILK_ASSERT(child->join_counter == 0);
+    CILK_ASSERT(atomic_load_explicit(&child->join_counter,
+                                     memory_order_relaxed) == 0);
     CILK_ASSERT(child->status == CLOSURE_RETURNING);
     CILK_ASSERT(child->owner_ready_deque == NO_WORKER);
     Closure_assert_alienation(self, child);
@@ -372,7 +467,7 @@ static Closure *Closure_return(__cilkrts_worker *const w, worker_id self,
     /* The frame should have passed a sync successfully meaning it
        has not accumulated any maps from its children and the
        active map is in the worker rather than the closure. */
-    CILK_ASSERT(!child->child_ht && !child->user_ht);
+    CILK_ASSERT(!child->child_ht && !child->user_ht && !child->comm_ht);
 
     /* If in the future the worker's map is not created lazily,
        assert it is not null here. */
@@ -380,14 +475,30 @@ static Closure *Closure_return(__cilkrts_worker *const w, worker_id self,
     /* need a loop as multiple siblings can return while we
        are performing reductions */
 
+    // Deal with reducers.
+    // Get the current active hypermap.
+    hyper_table *active_ht = take_local_hyper_table(w);
+    // Views of commutative reducers need not wait until the views of the
+    // child's siblings are next to them.  Fold them into the views the
+    // parent's other children left right away.
+    hyper_table *comm_ht = split_commutative_views(active_ht);
+    while (comm_ht) {
+        hyper_table *parent_ht = NULL;
+        if (atomic_compare_exchange_strong_explicit(
+                &parent->comm_ht, &parent_ht, comm_ht, memory_order_release,
+                memory_order_relaxed))
+            break;
+        // Another child left views first.  Take them and try again.
+        parent_ht = atomic_exchange_explicit(&parent->comm_ht, NULL,
+                                             memory_order_acquire);
+        if (parent_ht)
+            comm_ht = merge_two_hts(parent_ht, comm_ht);
+    }
+
     // always lock from top to bottom
     Closure_lock(self, parent);
     Closure_lock(self, child);
 
-    // Deal with reducers.
-    // Get the current active hypermap.
-    hyper_table *active_ht = w->hyper_table;
-    w->hyper_table = NULL;
     while (true) {
         // invariant: a closure cannot unlink itself w/out lock on parent
         // so what this points to cannot change while we have lock on parent
@@ -432,13 +543,15 @@ static Closure *Closure_return(__cilkrts_worker *const w, worker_id self,
 
     /* The returning closure and its parent are locked. */
 
-    // Execute left-holder logic for stacks.
+    // Execute left-holder logic for stacks.  Fibers are freed after the
+    // parent is unlocked, to keep other returning children waiting less.
+    struct cilk_fiber *fiber_to_free = NULL, *ext_fiber_to_free = NULL;
     if (child->left_sib || parent->fiber_child) {
         // Case where we are not the leftmost stack.
         CILK_ASSERT(parent->fiber_child != child->fiber);
-        cilk_fiber_deallocate_to_pool(w, child->fiber);
-        if (USE_EXTENSION && child->ext_fiber) {
-            cilk_fiber_deallocate_to_pool(w, child->ext_fiber);
+        fiber_to_free = child->fiber;
+        if (USE_EXTENSION) {
+            ext_fiber_to_free = child->ext_fiber;
         }
     } else {
         // We are leftmost, pass stack/fiber up to parent.
@@ -471,33 +584,48 @@ static Closure *Closure_return(__cilkrts_worker *const w, worker_id self,
     // occur as the worker depositing the views to our right_ht also
     // must hold lock on the parent to do so.
     Closure_unlock(self, child);
-    /*    Closure_unlock(parent);*/
-
-    Closure_destroy(w, child);
-
-    /*    Closure_lock(parent);*/
 
     CILK_ASSERT(parent->status != CLOSURE_RETURNING);
     CILK_ASSERT(parent->frame != NULL);
     // CILK_ASSERT(parent->frame->magic == CILK_STACKFRAME_MAGIC);
-    CILK_ASSERT(parent->join_counter);
 
-    --parent->join_counter;
+    // Leave without the parent lock unless we may be the last child.
+    unsigned int count =
+        atomic_load_explicit(&parent->join_counter, memory_order_relaxed);
+    CILK_ASSERT(count);
+    if (count > 1) {
+        Closure_unlock(self, parent);
+        while (count > 1 &&
+               !atomic_compare_exchange_weak_explicit(
+                   &parent->join_counter, &count, count - 1,
+                   memory_order_release, memory_order_relaxed))
+            ;
+        if (count > 1)
+            goto done;
+        // The other children returned meanwhile.
+        Closure_lock(self, parent);
+    }
+
+    atomic_fetch_sub_explicit(&parent->join_counter, 1, memory_order_release);
 
     res = provably_good_steal_maybe(w, self, parent);
 
     if (res) {
-        hyper_table *child_ht = parent->child_ht;
-        hyper_table *active_ht = parent->user_ht;
-        parent->child_ht = NULL;
-        parent->user_ht = NULL;
-        w->hyper_table = merge_two_hts(child_ht, active_ht);
-
-        setup_for_execution(w, res);
+        resume_after_sync(w, res);
     }
 
     Closure_unlock(self, parent);
 
+done:
+    // The child is unlinked, so no one else can reach it or its fibers.
+    Closure_destroy(w, child);
+    if (fiber_to_free) {
+        cilk_fiber_deallocate_to_pool(w, fiber_to_free);
+    }
+    if (ext_fiber_to_free) {
+        cilk_fiber_deallocate_to_pool(w, ext_fiber_to_free);
+    }
+
     return res;
 }
 
@@ -608,96 +736,6 @@ static inline bool trivial_stacklet(const __cilkrts_stack_frame *head) {
     return is_trivial;
 }
 
-/*
- * This return the oldest frame in stacklet that has not been promoted to
- * full frame (i.e., never been stolen), or the closest detached frame
- * if nothing in this stacklet has been promoted.
- */
-static inline __cilkrts_stack_frame *
-oldest_non_stolen_frame_in_stacklet(__cilkrts_stack_frame *head) {
-
-    __cilkrts_stack_frame *cur = head;
-    while (cur && (cur->flags & CILK_FRAME_DETACHED) == 0 && cur->call_parent &&
-           __cilkrts_not_stolen(cur->call_parent)) {
-        cur = cur->call_parent;
-    }
-
-    return cur;
-}
-
-static Closure *setup_call_parent_closure_helper(
-    __cilkrts_worker *const w, __cilkrts_worker *const victim_w,
-    __cilkrts_stack_frame *frame, void *extension, Closure *oldest) {
-    Closure *call_parent, *curr_cl;
-
-    if (oldest->frame == frame) {
-        CILK_ASSERT(__cilkrts_stolen(oldest->frame));
-        CILK_ASSERT(oldest->fiber);
-        return oldest;
-    }
-    call_parent = setup_call_parent_closure_helper(
-        w, victim_w, frame->call_parent, extension, oldest);
-    __cilkrts_set_stolen(frame);
-    curr_cl = Closure_create(w, frame);
-
-    CILK_ASSERT(call_parent->fiber);
-
-    Closure_set_status(curr_cl, CLOSURE_SUSPENDED);
-    curr_cl->fiber = call_parent->fiber;
-
-    if (USE_EXTENSION) {
-        curr_cl->frame->extension = extension;
-        curr_cl->ext_fiber = call_parent->ext_fiber;
-    }
-
-    Closure_add_callee(call_parent, curr_cl);
-
-    return curr_cl;
-}
-
-/***
- * ANGE: youngest_cl is the spawning parent that the thief is trying to
- * extract and resume.  Temporarily its call_parent is pointing to the
- * oldest closure on top of victim's deque when the steal occurs.
- * There may be more frames between them (i.e., stacklet contains more
- * than two frames) that require promotion.  This function promotes
- * and suspends them.
- ***/
-static void setup_closures_in_stacklet(__cilkrts_worker *const w,
-                                       __cilkrts_worker *const victim_w,
-                                       Closure *youngest_cl) {
-
-    Closure *call_parent;
-    Closure *oldest_cl = youngest_cl->call_parent;
-    __cilkrts_stack_frame *youngest, *oldest;
-    youngest = youngest_cl->frame;
-    void *extension = USE_EXTENSION ? youngest->extension : NULL;
-    oldest = oldest_non_stolen_frame_in_stacklet(youngest);
-
-    CILK_ASSERT_POINTER_EQUAL(youngest, youngest_cl->frame);
-    CILK_ASSERT(__cilkrts_stolen(youngest));
-
-    CILK_ASSERT((oldest_cl->frame == NULL && oldest != youngest) ||
-                       (oldest_cl->frame == oldest->call_parent &&
-                        __cilkrts_stolen(oldest_cl->frame)));
-
-    if (oldest_cl->frame == NULL) {
-        CILK_ASSERT(__cilkrts_not_stolen(oldest));
-        CILK_ASSERT(oldest->flags & CILK_FRAME_DETACHED);
-        __cilkrts_set_stolen(oldest);
-        oldest_cl->frame = oldest;
-        if (USE_EXTENSION) {
-            oldest_cl->frame->extension = extension;
-        }
-    }
-
-    call_parent = setup_call_parent_closure_helper(
-        w, victim_w, youngest->call_parent, extension, oldest_cl);
-
-    CILK_ASSERT(youngest_cl->fiber != oldest_cl->fiber);
-    Closure_add_callee(call_parent, youngest_cl);
-}
-
 /*
  * Do the thief part of Dekker's protocol.  Return the head pointer upon
  * success, NULL otherwise.  The protocol fails when the victim already popped T
@@ -809,7 +847,9 @@ static Closure *promote_child(__cilkrts_stack_frame **head, ReadyDeque *deques,
         // cl->frame was stolen and resumed, it calls another frame which
         // spawned, and the spawned frame is the frame_to_steal now). ANGE:
         // if this is the case, we must create a new Closure representing
-        // the left-most frame (the one to be stolen and resume).
+        // the left-most frame (the one to be stolen and resume).  The called
+        // frames between it and cl->frame get no Closure; see
+        // finish_promote.
         spawn_parent = Closure_create(w, frame_to_steal);
         __cilkrts_set_stolen(frame_to_steal);
         Closure_set_status(spawn_parent, CLOSURE_RUNNING);
@@ -880,7 +920,8 @@ static Closure *promote_child(__cilkrts_stack_frame **head, ReadyDeque *deques,
      ***/
     Closure_add_child(self, spawn_parent, spawn_child);
 
-    ++spawn_parent->join_counter;
+    atomic_fetch_add_explicit(&spawn_parent->join_counter, 1,
+                              memory_order_relaxed);
 
     atomic_store_explicit(&victim_w->head, head + 1, memory_order_release);
 
@@ -898,26 +939,18 @@ static Closure *promote_child(__cilkrts_stack_frame **head, ReadyDeque *deques,
  * the child).  This function does some more work on the parent to make
  * the promotion complete.
  *
- * ANGE: This includes promoting everything along the stolen stacklet
- * into full closures.
+ * Frames of the stolen stacklet between the parent's frame and the frame
+ * of its call_parent Closure are not promoted.  They stay plain stack
+ * frames, not marked stolen, and return without entering the runtime.
+ * When the parent returns, its call_parent Closure resumes running them.
+ * One of them gets a Closure only if it is stolen later, in promote_child.
  ***/
-static void finish_promote(__cilkrts_worker *const w, worker_id self,
-                           __cilkrts_worker *const victim_w, Closure *parent,
-                           bool has_frames_to_promote) {
+static void finish_promote(worker_id self, Closure *parent) {
 
     Closure_assert_ownership(self, parent);
     CILK_ASSERT(parent->has_cilk_callee == 0);
     CILK_ASSERT(__cilkrts_stolen(parent->frame));
 
-    // ANGE: if there are more frames to promote, the youngest frame that we
-    // are stealing (i.e., parent) has been promoted and its closure call_parent
-    // has been set to the closure of the oldest frame in the stacklet
-    // temporarily, with multiple shadow frames in between that still need
-    // their own closure.  Set those up.
-    if (has_frames_to_promote) {
-        setup_closures_in_stacklet(w, victim_w, parent);
-    }
-
     __cilkrts_set_unsynced(parent->frame);
     /* Make the parent ready */
     Closure_make_ready(parent);
@@ -926,16 +959,20 @@ static void finish_promote(__cilkrts_worker *const w, worker_id self,
 }
 
 /***
- * ANGE: This function promotes all frames in the top-most stacklet into
- * its own closures and also creates a new child closure to leave it with
- * the victim.  Normally this is invoked by Closure_steal, but a worker
- * may also invoke Closure steal on itself (for the purpose of race detecting
- * Cilk code with reducers).  Thus, this function is written to check for
- * that --- if w == victim_w, we don't actually create a new fiber for
- * the stolen parent.
+ * Steal the frame at the top of victim_w's deque, the parent of a spawn, and
+ * return its Closure.  promote_child gives only that frame a Closure, if it
+ * has none yet, and creates a new child Closure to leave with the victim.
+ * The called frames between it and the frame of cl stay plain stack frames;
+ * see finish_promote, which the caller invokes next.  The child keeps cl's
+ * fiber, which holds the stack, and the parent gets a new fiber.
+ *
+ * Normally this is invoked by Closure_steal, but promote_own_deque invokes it
+ * with w == victim_w.  The parent then gets no fiber, since it does not run
+ * again before the child returns and hands its fiber up.
  *
  * NOTE: this function assumes that w holds the lock on victim_w's deque
- * and Closure cl and releases them before returning.
+ * and Closure cl.  It returns with the deque and the returned Closure
+ * locked; cl is unlocked if it is not the one returned.
  ***/
 static Closure *extract_top_spawning_closure(__cilkrts_stack_frame **head,
                                              ReadyDeque *deques,
@@ -969,9 +1006,14 @@ static Closure *extract_top_spawning_closure(__cilkrts_stack_frame **head,
         CILK_ASSERT_POINTER_EQUAL(cl, res);
     }
 
-    res->fiber = cilk_fiber_allocate_from_pool(w);
-    if (USE_EXTENSION) {
-        res->ext_fiber = cilk_fiber_allocate_from_pool(w);
+    if (w != victim_w) {
+        res->fiber = cilk_fiber_allocate_from_pool(w);
+        if (USE_EXTENSION) {
+            res->ext_fiber = cilk_fiber_allocate_from_pool(w);
+        }
+    } else {
+        res->fiber = NULL;
+        res->ext_fiber = NULL;
     }
 
     // make sure we are not holding the lock on child
@@ -1027,6 +1069,17 @@ static Closure *Closure_steal(__cilkrts_worker **workers,
         switch (cl->status) {
         case CLOSURE_RUNNING: {
 
+            // Decline the steal if no fiber can be had for the stolen
+            // continuation, because the fiber caps are reached or the OS is
+            // out of memory.  The victim then executes the continuation
+            // itself, serially.  Reserve only now, so that a steal that
+            // fails to take the locks does not refill the pool.
+            if (!cilk_fiber_pool_reserve(w, USE_EXTENSION ? 2 : 1)) {
+                cilkrts_alert(STEAL,
+                              "(Closure_steal) declined; no fiber available");
+                goto give_up;
+            }
+
             /* send the exception to the worker */
             __cilkrts_stack_frame **head = do_dekker_on(self, victim_w, cl);
             if (head) {
@@ -1043,8 +1096,7 @@ static Closure *Closure_steal(__cilkrts_worker **workers,
                 Closure_assert_ownership(self, res);
 
                 // ANGE: finish the promotion process in finish_promote
-                finish_promote(w, self, victim_w, res,
-                               /* has_frames_to_promote */ false);
+                finish_promote(self, res);
 
                 cilkrts_alert(STEAL,
                               "(Closure_steal) success; res %p has "
@@ -1118,16 +1170,13 @@ void promote_own_deque(__cilkrts_worker *w) {
         }
         __cilkrts_stack_frame **head = do_dekker_on(self, w, cl);
         if (head) {
-            // unfortunately this function releases both locks
+            // this leaves the deque and res locked
             Closure *res = extract_top_spawning_closure(head, deques, w, w, cl, self, self);
             CILK_ASSERT(res);
             CILK_ASSERT_NULL(res->fiber);
 
-            // ANGE: if cl is not the spawning parent, then
-            // there is more frames in the stacklet to promote
-            bool has_frames_to_promote = (cl != res);
             // ANGE: finish the promotion process in finish_promote
-            finish_promote(w, self, w, res, has_frames_to_promote);
+            finish_promote(self, res);
 
             Closure_set_status(res, CLOSURE_SUSPENDED);
             Closure_unlock(self, res);
@@ -1258,11 +1307,11 @@ int Cilk_sync(__cilkrts_worker *const w, __cilkrts_stack_frame *frame) {
         // be reduced before the sync as this Closure's children return, and
         // views in this hypermap will need to be reduced with those when a
         // provably good steal occurs.
-        hyper_table *ht = w->hyper_table;
-        w->hyper_table = NULL;
+        hyper_table *ht = take_local_hyper_table(w);
 
         Closure_suspend(deques, self, t);
         t->user_ht = ht; /* set this after state change to suspended */
+        t->sync_worker = self;
         res = SYNC_NOT_READY;
     } else {
         cilkrts_alert(SYNC, "(Cilk_sync) closure %p sync successfully",
@@ -1279,6 +1328,10 @@ int Cilk_sync(__cilkrts_worker *const w, __cilkrts_stack_frame *frame) {
             t->child_ht = NULL;
             w->hyper_table = merge_two_hts(child_ht, w->hyper_table);
         }
+        hyper_table *comm_ht =
+            atomic_exchange_explicit(&t->comm_ht, NULL, memory_order_acquire);
+        if (comm_ht)
+            w->hyper_table = merge_two_hts(w->hyper_table, comm_ht);
 
 #if CILK_ENABLE_ASAN_HOOKS
         sanitizer_unpoison_fiber(t->fiber);
@@ -1407,6 +1460,7 @@ void worker_scheduler(__cilkrts_worker *w) {
     global_state *rts = w->g;
     worker_id self = w->self;
     const bool is_boss = (0 == self);
+    const bool resume_affinity = rts->options.resume_affinity;
 
     // Get this worker's local_state pointer, to avoid rereading it
     // unnecessarily during the work-stealing loop.  This optimization helps
@@ -1495,8 +1549,13 @@ void worker_scheduler(__cilkrts_worker *w) {
                 // Attempt to steal from that victim.
                 t = Closure_steal(workers, deques, w, self, victim);
                 if (!t) {
-                    // Pause inside this busy loop.
+                    // Pause inside this busy loop, accepting a closure to
+                    // resume meanwhile.
+                    if (resume_affinity)
+                        mailbox_open(deques, self);
                     busy_loop_pause();
+                    if (resume_affinity)
+                        t = take_from_mailbox(w, self, deques);
                 }
             } while (!t && --attempt > 0);
 
@@ -1534,6 +1593,8 @@ void worker_scheduler(__cilkrts_worker *w) {
                 //   of sentinels and increase the delay by approximately S/lg
                 //   S, which seems to work better than a linear increase in
                 //   practice.
+                if (resume_affinity)
+                    mailbox_open(deques, self);
 #ifndef __APPLE__
 #ifndef __aarch64__
                 uint64_t stop = 450 * ATTEMPTS;
@@ -1558,6 +1619,13 @@ void worker_scheduler(__cilkrts_worker *w) {
                     busy_pause();
 #endif // __aarch64__
 #endif // __APPLE__
+                if (resume_affinity &&
+                    (t = take_from_mailbox(w, self, deques)))
+                    fails = go_to_sleep_maybe(
+                        rts, self, nworkers, NAP_THRESHOLD, w, t, fails,
+                        &sample_threshold, &inefficient_history,
+                        &efficient_history, sentinel_count_history,
+                        &sentinel_count_history_tail, &recent_sentinel_count);
             }
         }
         CILK_START_TIMING(w, INTERVAL_SCHED);
@@ -1654,6 +1722,9 @@ void *scheduler_thread_proc(void *arg) {
         // seems to result in better performance.
         if (thief_should_wait(rts)) {
             disengage_worker(rts, nworkers, self);
+            // A Cilkified region just ended; give back memory it freed.
+            if (atomic_load_explicit(&rts->done, memory_order_acquire))
+                cilk_internal_malloc_trim(rts);
             l->wake_val = thief_wait(rts);
             reengage_worker(rts, nworkers, self);
         }
@@ -12,6 +12,12 @@ unsigned __cilkrts_get_worker_number(void) { return 0; }
 #define CHEETAH_INTERNAL
 #include "../runtime/local-hypertable.h"
 
+// Dummy implementations of the hypertable memory hooks, without a worker
+// memory pool.
+bool hyper_table_mem_pooled(void) { return false; }
+void *hyper_table_mem_alloc(size_t size, bool pooled) { return malloc(size); }
+void hyper_table_mem_free(void *p, size_t size, bool pooled) { free(p); }
+
 // Print alert message
 void ALERT(const char *fmt, ...) {
     va_list l;
@@ -46,15 +52,15 @@ typedef struct table_command {
 void verify_hypertable(hyper_table *table, uintptr_t key, int32_t expected_count) {
     int32_t key_count = 0;
     int32_t capacity = table->capacity;
-    struct bucket *buckets = table->buckets;
-    PRINT_TRACE("table(%p): cap %d, occ %d, ins_rm %d\n", buckets, capacity,
+    uintptr_t *keys = table->keys;
+    PRINT_TRACE("table(%p): cap %d, occ %d, ins_rm %d\n", keys, capacity,
                 table->occupancy, table->ins_rm_count);
     if (capacity < MIN_HT_CAPACITY) {
         int32_t occupancy = table->occupancy;
         for (int32_t i = 0; i < occupancy; ++i) {
-            PRINT_TRACE("table(%p)[%d] = { 0x%lx, %p }\n", buckets, i,
-                        buckets[i].key, buckets[i].value.view);
-            if (is_valid(key) && buckets[i].key == key)
+            PRINT_TRACE("table(%p)[%d] = { 0x%lx, %p }\n", keys, i,
+                        keys[i], table->values[i].view);
+            if (is_valid(key) && keys[i] == key)
                 key_count++;
         }
         if (key_count != expected_count)
@@ -65,10 +71,10 @@ void verify_hypertable(hyper_table *table, uintptr_t key, int32_t expected_count
     }
 
     for (int32_t i = 0; i < capacity; ++i) {
-        PRINT_TRACE("table(%p)[%d] = { 0x%lx, %d, %p }\n", buckets, i,
-                    buckets[i].key, buckets[i].hash,
-                    is_valid(buckets[i].key) ? buckets[i].value.view : NULL);
-        if (is_valid(key) && buckets[i].key == key)
+        PRINT_TRACE("table(%p)[%d] = { 0x%lx, %d, %p }\n", keys, i,
+                    keys[i], table->hashes[i],
+                    is_valid(keys[i]) ? table->values[i].view : NULL);
+        if (is_valid(key) && keys[i] == key)
             key_count++;
     }
     if (key_count != expected_count)
@@ -83,18 +89,18 @@ bool check_hypertable(hyper_table *table, uintptr_t key,
                       int32_t expected_count) {
     int32_t key_count = 0;
     int32_t capacity = table->capacity;
-    struct bucket *buckets = table->buckets;
+    uintptr_t *keys = table->keys;
     if (capacity < MIN_HT_CAPACITY) {
         int32_t occupancy = table->occupancy;
         for (int32_t i = 0; i < occupancy; ++i) {
-            if (is_valid(key) && buckets[i].key == key)
+            if (is_valid(key) && keys[i] == key)
                 key_count++;
         }
         return key_count == expected_count;
     }
 
     for (int32_t i = 0; i < capacity; ++i) {
-        if (is_valid(key) && buckets[i].key == key)
+        if (is_valid(key) && keys[i] == key)
             key_count++;
     }
     return key_count == expected_count;
@@ -119,7 +125,7 @@ void do_table_command(hyper_table *table, table_command cmd) {
     }
     case TABLE_LOOKUP: {
         PRINT_TRACE("LOOKUP 0x%lx\n", cmd.key);
-        struct bucket *b = find_hyperobject(table, cmd.key);
+        reducer_base *b = find_hyperobject(table, cmd.key);
         verify_hypertable(table, cmd.key, NULL != b);
         break;
     }
@@ -165,8 +171,13 @@ void test_set_insert_remove(const uintptr_t *keys, int num_keys,
     for (int i = 0; i < num_keys; ++i) {
         num_valid += is_valid(keys[i]);
         num_tomb += is_tombstone(keys[i]);
-        table->buckets[i].key = keys[i];
-        table->buckets[i].hash = hash(keys[i]) % num_keys;
+        table->keys[i] = keys[i];
+        if (is_valid(keys[i]))
+            table->hashes[i] = hash(keys[i]) % num_keys;
+        else if (is_empty(keys[i]))
+            table->hashes[i] = empty_hash(i);
+        else
+            table->hashes[i] = tombstone_hash(i);
     }
     table->occupancy = num_valid;
     table->ins_rm_count = num_tomb;
@@ -178,3 +189,137 @@ void test_set_insert_remove(const uintptr_t *keys, int num_keys,
     }
     local_hyper_table_free(table);
 }
+
+// Reduce function for test_merge.  Views hold their key, with the low bit
+// set in the left view of a key in both tables once the right view is merged
+// into it.
+void merge_views(void *left, void *right) {
+    assert(*(uintptr_t *)left == *(uintptr_t *)right &&
+           "merging views of different keys");
+    *(uintptr_t *)left |= 1;
+}
+
+// Insert key into table with a fresh view for it.
+void insert_view(hyper_table *table, uintptr_t key) {
+    uintptr_t *view = malloc(sizeof(uintptr_t));
+    *view = key;
+    bool success = insert_hyperobject(
+        table, (struct bucket){.key = key,
+                               .value = {.view = view,
+                                         .reduce_fn = merge_views}});
+    assert(success && "insert_hyperobject failed");
+}
+
+// Merge a table holding left_keys with one holding right_keys, and check that
+// the merged table holds every key once, with the views of keys in both
+// tables merged.  The keys must be even.
+void test_merge(const uintptr_t *left_keys, int num_left,
+                const uintptr_t *right_keys, int num_right) {
+    hyper_table *left = __cilkrts_local_hyper_table_alloc();
+    hyper_table *right = __cilkrts_local_hyper_table_alloc();
+    for (int i = 0; i < num_left; ++i)
+        insert_view(left, left_keys[i]);
+    for (int i = 0; i < num_right; ++i)
+        insert_view(right, right_keys[i]);
+
+    hyper_table *table = merge_two_hts(left, right);
+    int32_t num_merged = num_left;
+    for (int i = 0; i < num_left; ++i) {
+        uintptr_t key = left_keys[i];
+        bool in_right = false;
+        for (int j = 0; j < num_right; ++j)
+            in_right |= right_keys[j] == key;
+        reducer_base *b = find_hyperobject(table, key);
+        assert(b && "key of left table missing after merge");
+        assert(*(uintptr_t *)b->view == (key | in_right) &&
+               "wrong view after merge");
+        verify_hypertable(table, key, 1);
+    }
+    for (int j = 0; j < num_right; ++j) {
+        uintptr_t key = right_keys[j];
+        bool in_left = false;
+        for (int i = 0; i < num_left; ++i)
+            in_left |= left_keys[i] == key;
+        if (in_left)
+            continue;
+        ++num_merged;
+        reducer_base *b = find_hyperobject(table, key);
+        assert(b && *(uintptr_t *)b->view == key &&
+               "key of right table missing after merge");
+        verify_hypertable(table, key, 1);
+    }
+    assert(table->occupancy == num_merged);
+
+    int32_t capacity = table->capacity < MIN_HT_CAPACITY ? table->occupancy
+                                                         : table->capacity;
+    for (int32_t i = 0; i < capacity; ++i) {
+        if (is_valid(table->keys[i]))
+            free_view(&table->values[i]);
+    }
+    local_hyper_table_free(table);
+}
+
+// Commutative reduce function for test_merge_registered_view.
+void add_views(void *left, void *right) { *(long *)left += *(long *)right; }
+
+void zero_view(void *view) { *(long *)view = 0; }
+
+// Merge a table holding an identity view of a commutative reducer, which a
+// lookup has cached, with a table holding the view the reducer registered,
+// as when a child returns the registered view past a thief.  Check that the
+// registered view survives, and that lookups in the merged table find it
+// rather than the freed identity view, and that splitting the merged table
+// moves just that view.  Both tables also hold the keys in other_keys, which
+// must be even.
+void test_merge_registered_view(const uintptr_t *other_keys, int num_other) {
+    int ret = add_commutative_reduce(add_views);
+    assert(ret == 0 && "add_commutative_reduce failed");
+    long *registered = malloc(sizeof(long));
+    *registered = 1;
+    uintptr_t key = (uintptr_t)registered;
+
+    hyper_table *left = __cilkrts_local_hyper_table_alloc();
+    hyper_table *right = __cilkrts_local_hyper_table_alloc();
+    for (int i = 0; i < num_other; ++i) {
+        insert_view(left, other_keys[i]);
+        insert_view(right, other_keys[i]);
+    }
+    long *identity = __cilkrts_insert_new_view(left, key, sizeof(long),
+                                               zero_view, add_views);
+    assert(lookup_view(left, key) == identity);
+    *identity = 2;
+    bool success = insert_hyperobject(
+        right, (struct bucket){.key = key,
+                               .value = {.view = registered,
+                                         .reduce_fn = add_views}});
+    assert(success && "insert_hyperobject failed");
+
+    hyper_table *table = merge_two_hts(left, right);
+    assert(lookup_view(table, key) == registered &&
+           "lookup found the wrong view after merge");
+    assert(*registered == 3 && "wrong view after merge");
+    verify_hypertable(table, key, 1);
+    assert(table->commutative == 1 && "wrong count of commutative views");
+
+    // Splitting off the views of commutative reducers moves only that view,
+    // and a table without any is not scanned again.
+    hyper_table *split = split_commutative_views(table);
+    assert(split && split->occupancy == 1 && split->commutative == 1 &&
+           "wrong views split off");
+    assert(table->occupancy == num_other && table->commutative == 0 &&
+           "wrong views left after split");
+    assert(!split_commutative_views(table));
+    assert(lookup_view(split, key) == registered);
+
+    hyper_table *tables[] = {table, split};
+    for (int t = 0; t < 2; ++t) {
+        int32_t capacity = tables[t]->capacity < MIN_HT_CAPACITY
+                               ? tables[t]->occupancy
+                               : tables[t]->capacity;
+        for (int32_t i = 0; i < capacity; ++i) {
+            if (is_valid(tables[t]->keys[i]))
+                free_view(&tables[t]->values[i]);
+        }
+        local_hyper_table_free(tables[t]);
+    }
+}
@@ -220,6 +220,40 @@ void test5(void) {
     test_insert_remove(test, sizeof(test)/sizeof(table_command));
 }
 
+void test6(void) {
+    // Merge tables of the same capacity whose runs wrap around the end of the
+    // table, sharing some keys, including keys with the same hash.
+    uintptr_t left[] = {0x2, 0x4, 0xc, 0xe, 0x1e, 0x2e, 0x12, 0x22};
+    uintptr_t right[] = {0x4, 0x6, 0xe, 0x2e, 0x3e, 0x22, 0x32, 0x10};
+    test_merge(left, sizeof(left)/sizeof(uintptr_t), right,
+               sizeof(right)/sizeof(uintptr_t));
+    // Merge in the other direction, growing the table.
+    test_merge(right, sizeof(right)/sizeof(uintptr_t), left,
+               sizeof(left)/sizeof(uintptr_t));
+}
+
+void test7(void) {
+    // Merge tables of different capacities, and a table much smaller than
+    // the other, in both directions.
+    uintptr_t big[32];
+    for (int i = 0; i < 32; ++i)
+        big[i] = 2 * i + 2 + 0x40 * (i % 3);
+    uintptr_t some[] = {0x4, 0x42, 0x86, 0x100, 0x102, 0x13e};
+    uintptr_t one[] = {0x8a};
+    test_merge(big, 32, some, sizeof(some)/sizeof(uintptr_t));
+    test_merge(some, sizeof(some)/sizeof(uintptr_t), big, 32);
+    test_merge(big, 32, one, 1);
+    test_merge(one, 1, big, 32);
+}
+
+void test8(void) {
+    // Merge a cached identity view of a commutative reducer with its
+    // registered view, in small tables and in tables merged in hash order.
+    test_merge_registered_view(NULL, 0);
+    uintptr_t some[] = {0x4, 0x42, 0x86, 0x100, 0x102, 0x13e, 0x8a};
+    test_merge_registered_view(some, sizeof(some)/sizeof(uintptr_t));
+}
+
 int main(int argc, char *argv[]) {
     int to_run = -1;
     if (argc > 1)
@@ -249,5 +283,17 @@ int main(int argc, char *argv[]) {
         test5();
         printf("test5 PASSED\n");
     }
+    if (to_run < 0 || to_run == 6) {
+        test6();
+        printf("test6 PASSED\n");
+    }
+    if (to_run < 0 || to_run == 7) {
+        test7();
+        printf("test7 PASSED\n");
+    }
+    if (to_run < 0 || to_run == 8) {
+        test8();
+        printf("test8 PASSED\n");
+    }
     return 0;
 }